@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2011 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * The far end of nacl_argfile_test.sh: run in a loader's place, it
+ * expands a NACL_INTERP_ARGFILE reference with nacl_expand_argv, as
+ * sel_ldr would, and prints the arguments it ends up with after
+ * "PLATFORM NEXE", one per line.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "nacl_spawn.h"
+
+int main(int argc, char **argv) {
+  int error = nacl_expand_argv(&argc, &argv);
+  int i;
+
+  if (error != 0) {
+    fprintf(stderr, "nacl_argfile_test: %s\n", strerror(error));
+    return 1;
+  }
+  for (i = 3; i < argc; ++i)
+    puts(argv[i]);
+  return 0;
+}
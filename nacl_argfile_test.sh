@@ -0,0 +1,68 @@
+#!/bin/sh
+# Copyright (c) 2011 The Native Client Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+#
+# Usage: nacl_argfile_test.sh INTERP EXPANDER
+#
+# Round-trips a nexe's arguments through NACL_INTERP_ARGFILE: a nexe
+# whose PT_INTERP is INTERP is run with a long argument list, and its
+# loader, marked with the user.nacl.argfile attribute, runs EXPANDER
+# (nacl_argfile_test), which expands the reference with nacl_expand_argv
+# and prints what it got.  $CC (default cc) builds the nexe.
+
+set -e
+
+interp=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+expander=$(cd "$(dirname "$2")" && pwd)/$(basename "$2")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+fail() {
+  echo >&2 "nacl_argfile_test.sh: $*"
+  exit 1
+}
+
+echo 'void _start(void) { for (;;); }' > nexe.c
+${CC:-cc} -nostdlib -pie -Wl,--dynamic-linker="$interp" -o nexe nexe.c
+
+printf '#!/bin/sh\nexec "%s" "$@"\n' "$expander" > loader
+chmod +x loader
+
+NACL_INTERP_LOADER=$dir/loader
+NACL_INTERP_ARGFILE=16
+export NACL_INTERP_LOADER NACL_INTERP_ARGFILE
+
+# Unmarked, the arguments go through as they are.
+./nexe 'first arg' '' "$dir" > unmarked
+printf 'first arg\n\n%s\n' "$dir" | cmp -s - unmarked ||
+  fail "unmarked loader got: $(cat unmarked)"
+
+# A reference to a descriptor that isn't open is just an argument.
+[ "$("$expander" x86_64 nexe @/proc/self/fd/99)" = @/proc/self/fd/99 ] ||
+  fail "a reference to a closed descriptor was expanded"
+
+# Any value marks the loader, not just a one-byte one.
+if command -v setfattr > /dev/null; then
+  setfattr -n user.nacl.argfile -v yes loader
+else
+  python3 -c 'import os; os.setxattr("loader", "user.nacl.argfile", b"yes")'
+fi || {
+  echo "nacl_argfile_test.sh: skipped; no user xattrs on $dir"
+  exit 0
+}
+
+seq 1 2000 > expected
+echo '' >> expected
+echo 'with  spaces' >> expected
+./nexe $(seq 1 2000) '' 'with  spaces' > marked
+cmp -s expected marked || fail "expanded arguments differ"
+
+# The loader really got a reference, not the arguments themselves.
+printf '#!/bin/sh\necho "$3"\n' > loader.new
+cat loader.new > loader
+./nexe $(seq 1 2000) | grep -q '^@/proc/self/fd/[0-9]*$' ||
+  fail "no argfile reference was passed"
+
+echo "nacl_argfile_test.sh: ok"
@@ -0,0 +1,649 @@
+/*
+ * Copyright (c) 2011 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * nacl-hotd: keep the most launched nexes, and the libraries they load,
+ * in the page cache.
+ *
+ * Usage: nacl-hotd [-v] [-s SLOTS] [-n TOP] [-b BUDGET] [-i SECONDS]
+ *                  [-C CACHEDIR] SOCKET
+ *
+ * The daemon listens on the unix datagram socket SOCKET, which
+ * nacl_interp_supervise reports each launch to when NACL_INTERP_HOTD
+ * names it.  A report is a one-byte datagram carrying an open descriptor
+ * for the nexe (SCM_RIGHTS).  The daemon takes the nexe's identity from
+ * the descriptor and its name from /proc/self/fd, and counts the launch
+ * only if that name still leads to the same file.  So a report can only
+ * count a file its sender could open, under the name the kernel gives
+ * it.  Only launches by users who can write SOCKET count; run one daemon
+ * per user, or make SOCKET writable by the group whose launches matter.
+ *
+ * The counts are kept in the daemon's own memory, in an open-addressing
+ * hash table of SLOTS (default 1024) slots keyed by the nexe's device
+ * and inode.  Each slot has a total and a decayed launch rate: launches,
+ * in 1/256ths, halving every HALF_LIFE seconds of quiet.  When three
+ * quarters of the slots are taken, the table is rebuilt with only the
+ * nexes that still have a rate, and twice as many slots if those alone
+ * fill half.
+ *
+ * Every SECONDS (default 10), the daemon ranks the nexes by their rate
+ * and pins the TOP (default 16) hottest that still exist under the name
+ * they were counted by.  With -C, it also pins each one's libraries, as
+ * listed in its nacl-ldconfig record in CACHEDIR.  Files are pinned
+ * hottest first, skipping any that would take the total past BUDGET
+ * bytes (default 256M; K, M and G suffixes work).  A file is pinned by
+ * mapping it and locking it with mlock; if that isn't allowed, it's only
+ * faulted in, and advised back in on each pass in case the kernel
+ * dropped it since.  Files that fall out of the top, or change, are
+ * unpinned.
+ *
+ * On SIGUSR1, the daemon prints the ranking on stdout.  With -v, it
+ * reports each file it pins and unpins on stderr.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nacl_interp_start.h"
+
+#define MAX_PROBE 16
+#define HALF_LIFE_SHIFT 6
+#define HALF_LIFE (1U << HALF_LIFE_SHIFT)
+#define ONE_LAUNCH 256          /* One launch, in a slot's RATE units.  */
+
+struct slot {
+  uint64_t key;                 /* slot_key, or 0 if free.  */
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t launches;
+  uint32_t last;                /* When it was last launched.  */
+  uint32_t rate;                /* Its decayed rate as of then.  */
+  char *path;
+};
+
+struct table {
+  struct slot *slots;
+  uint32_t nslots;              /* A power of two.  */
+  uint32_t used;
+};
+
+struct ranked {
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t launches;
+  uint32_t rate;
+  const char *path;
+};
+
+/*
+ * A file that's wanted or pinned.
+ */
+struct file {
+  char *path;
+  struct stat st;
+  void *map;
+  bool locked;
+};
+
+struct files {
+  struct file *v;
+  size_t n;
+};
+
+static int verbose;
+static volatile sig_atomic_t print_requested;
+
+static void die(const char *what) {
+  fprintf(stderr, "nacl-hotd: %s: %s\n", what, strerror(errno));
+  exit(1);
+}
+
+static void *xrealloc(void *p, size_t size) {
+  p = realloc(p, size);
+  if (p == NULL)
+    die("realloc");
+  return p;
+}
+
+static uint32_t now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec;
+}
+
+/*
+ * Mix the identity down to a well-spread key; never 0.
+ */
+static uint64_t slot_key(uint64_t dev, uint64_t ino) {
+  uint64_t h = (dev * 0x9e3779b97f4a7c15ULL) ^ ino;
+  h ^= h >> 29;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 32;
+  return h | 1;
+}
+
+/*
+ * RATE as of LAST, decayed to NOW.  Each half-life halves it, and in
+ * between it's interpolated linearly, which needs no division.
+ */
+static uint32_t decayed_rate(uint32_t rate, uint32_t last, uint32_t now) {
+  uint32_t elapsed = now > last ? now - last : 0;
+  uint32_t halvings = elapsed >> HALF_LIFE_SHIFT;
+  uint32_t part = elapsed & (HALF_LIFE - 1);
+
+  if (halvings >= 32)
+    return 0;
+  rate >>= halvings;
+  return rate - (uint32_t) (((uint64_t) rate * part) >>
+                            (HALF_LIFE_SHIFT + 1));
+}
+
+/*
+ * Find the slot for DEV/INO in TABLE, claiming a free one for PATH if
+ * it's new.  Returns NULL if its probe sequence is all taken by other
+ * nexes, in which case it goes uncounted.
+ */
+static struct slot *find_slot(struct table *table, uint64_t dev,
+                              uint64_t ino, const char *path) {
+  uint64_t key = slot_key(dev, ino);
+  uint32_t i;
+
+  for (i = 0; i < MAX_PROBE && i < table->nslots; ++i) {
+    struct slot *slot =
+        &table->slots[((key >> 1) + i) & (table->nslots - 1)];
+    if (slot->key == 0) {
+      slot->key = key;
+      slot->dev = dev;
+      slot->ino = ino;
+      slot->path = strdup(path);
+      if (slot->path == NULL)
+        die("strdup");
+      ++table->used;
+      return slot;
+    }
+    if (slot->key == key && slot->dev == dev && slot->ino == ino)
+      return slot;
+  }
+  return NULL;
+}
+
+static void count_launch(struct table *table, uint64_t dev, uint64_t ino,
+                         const char *path, uint32_t now) {
+  struct slot *slot = find_slot(table, dev, ino, path);
+  uint32_t rate;
+
+  if (slot == NULL)
+    return;
+  ++slot->launches;
+  rate = decayed_rate(slot->rate, slot->last, now);
+  slot->rate = rate > UINT32_MAX - ONE_LAUNCH ? UINT32_MAX
+      : rate + ONE_LAUNCH;
+  slot->last = now;
+}
+
+static void init_table(struct table *table, uint32_t nslots) {
+  table->slots = calloc(nslots, sizeof(table->slots[0]));
+  if (table->slots == NULL)
+    die("calloc");
+  table->nslots = nslots;
+  table->used = 0;
+}
+
+/*
+ * Replace TABLE with a fresh one of NSLOTS slots holding just the NLIVE
+ * entries of RANKED, which point into it.
+ */
+static void rebuild_table(struct table *table, uint32_t nslots,
+                          const struct ranked *ranked, size_t nlive,
+                          uint32_t now) {
+  struct table fresh;
+  size_t i;
+
+  init_table(&fresh, nslots);
+  for (i = 0; i < nlive; ++i) {
+    struct slot *slot = find_slot(&fresh, ranked[i].dev, ranked[i].ino,
+                                  ranked[i].path);
+    if (slot != NULL) {
+      slot->launches = ranked[i].launches;
+      slot->rate = ranked[i].rate;
+      slot->last = now;
+    }
+  }
+  for (i = 0; i < table->nslots; ++i)
+    free(table->slots[i].path);
+  free(table->slots);
+  *table = fresh;
+}
+
+/*
+ * Count the launch reported with descriptor FD, if the name the kernel
+ * has for it still leads to it.
+ */
+static void take_report(struct table *table, int fd) {
+  char link[64], path[PATH_MAX];
+  struct stat st, named;
+  ssize_t n;
+
+  snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+  n = readlink(link, path, sizeof(path) - 1);
+  if (n <= 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+    return;
+  path[n] = '\0';
+  if (path[0] != '/' || stat(path, &named) < 0 ||
+      named.st_dev != st.st_dev || named.st_ino != st.st_ino)
+    return;
+  count_launch(table, st.st_dev, st.st_ino, path, now_seconds());
+}
+
+/*
+ * Take every report waiting on SOCK.  Any descriptors beyond the first in
+ * a report are closed unread.
+ */
+static void take_reports(struct table *table, int sock) {
+  for (;;) {
+    union {
+      struct cmsghdr align;
+      char buf[CMSG_SPACE(4 * sizeof(int))];
+    } control;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    char byte;
+    int fd = -1;
+
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    if (recvmsg(sock, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC) < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      size_t i, nfds;
+      if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        continue;
+      nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      for (i = 0; i < nfds; ++i) {
+        int received;
+        memcpy(&received, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+        if (fd < 0)
+          fd = received;
+        else
+          close(received);
+      }
+    }
+    if (fd >= 0) {
+      take_report(table, fd);
+      close(fd);
+    }
+  }
+}
+
+static int compare_ranked(const void *a, const void *b) {
+  const struct ranked *x = a, *y = b;
+  if (x->rate != y->rate)
+    return x->rate > y->rate ? -1 : 1;
+  return x->launches > y->launches ? -1 : x->launches < y->launches;
+}
+
+/*
+ * Collect the entries of TABLE with their rates decayed to NOW, hottest
+ * first.
+ */
+static struct ranked *rank(const struct table *table, uint32_t now,
+                           size_t *n) {
+  struct ranked *v = xrealloc(NULL, table->nslots * sizeof(*v));
+  uint32_t i;
+
+  *n = 0;
+  for (i = 0; i < table->nslots; ++i) {
+    const struct slot *slot = &table->slots[i];
+    if (slot->key == 0)
+      continue;
+    v[*n].dev = slot->dev;
+    v[*n].ino = slot->ino;
+    v[*n].launches = slot->launches;
+    v[*n].rate = decayed_rate(slot->rate, slot->last, now);
+    v[*n].path = slot->path;
+    ++*n;
+  }
+  qsort(v, *n, sizeof(*v), compare_ranked);
+  return v;
+}
+
+static bool same_file(const struct stat *a, const struct stat *b) {
+  return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+      a->st_size == b->st_size &&
+      a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+      a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+/*
+ * Add PATH to WANTED if it's a regular file, isn't there already and
+ * fits in what's left of *BUDGET.  EXPECT, if not NULL, is the identity
+ * it must still have.
+ */
+static void want(struct files *wanted, const char *path,
+                 const struct ranked *expect, unsigned long long *budget) {
+  struct stat st;
+  size_t i;
+
+  if (stat(path, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    return;
+  if (expect != NULL && (st.st_dev != expect->dev || st.st_ino != expect->ino))
+    return;
+  for (i = 0; i < wanted->n; ++i)
+    if (wanted->v[i].st.st_dev == st.st_dev &&
+        wanted->v[i].st.st_ino == st.st_ino)
+      return;
+  if ((unsigned long long) st.st_size > *budget)
+    return;
+  *budget -= st.st_size;
+
+  wanted->v = xrealloc(wanted->v, (wanted->n + 1) * sizeof(wanted->v[0]));
+  wanted->v[wanted->n].path = strdup(path);
+  wanted->v[wanted->n].st = st;
+  wanted->v[wanted->n].map = NULL;
+  wanted->v[wanted->n].locked = false;
+  ++wanted->n;
+}
+
+/*
+ * Want each library in the nacl-ldconfig record for NEXE in CACHEDIR, if
+ * it's there and current.
+ */
+static void want_libraries(struct files *wanted, const char *cachedir,
+                           const struct stat *nexe,
+                           unsigned long long *budget) {
+  char identity[NACL_STAMP_SIZE], stamp[NACL_STAMP_SIZE];
+  char *path, *line = NULL;
+  size_t len = 0;
+  bool current = false;
+  FILE *f;
+
+  format_identity(identity, nexe->st_dev, nexe->st_ino);
+  format_stamp(stamp, nexe->st_dev, nexe->st_ino, nexe->st_mtim.tv_sec,
+               nexe->st_mtim.tv_nsec, nexe->st_size);
+  if (asprintf(&path, "%s/%s", cachedir, identity) < 0)
+    die("asprintf");
+  f = fopen(path, "r");
+  free(path);
+  if (f == NULL)
+    return;
+
+  while (getline(&line, &len, f) > 0) {
+    char *name, *lib;
+    line[strcspn(line, "\n")] = '\0';
+    if (!strncmp(line, NACL_RECORD_STAMP, strlen(NACL_RECORD_STAMP))) {
+      current = !strcmp(line + strlen(NACL_RECORD_STAMP), stamp);
+      continue;
+    }
+    if (!current || strncmp(line, "needed ", 7) != 0)
+      continue;
+    name = line + 7;
+    lib = strchr(name, ' ');
+    if (lib != NULL)
+      want(wanted, lib + 1, NULL, budget);
+  }
+  free(line);
+  fclose(f);
+}
+
+static void pin(struct file *file) {
+  int fd = open(file->path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+
+  if (fd < 0)
+    return;
+  if (fstat(fd, &st) < 0 || !same_file(&st, &file->st)) {
+    close(fd);
+    return;
+  }
+  file->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED | MAP_POPULATE,
+                   fd, 0);
+  close(fd);
+  if (file->map == MAP_FAILED) {
+    file->map = NULL;
+    return;
+  }
+  file->locked = mlock(file->map, st.st_size) == 0;
+  if (verbose)
+    fprintf(stderr, "nacl-hotd: pinned %s (%lld bytes%s)\n", file->path,
+            (long long) st.st_size, file->locked ? "" : ", not locked");
+}
+
+static void unpin(struct file *file) {
+  if (verbose)
+    fprintf(stderr, "nacl-hotd: unpinned %s\n", file->path);
+  munmap(file->map, file->st.st_size);
+  free(file->path);
+}
+
+/*
+ * Make PINNED match WANTED, which is consumed.
+ */
+static void repin(struct files *pinned, struct files *wanted) {
+  size_t i, j;
+
+  for (i = 0; i < pinned->n; ++i) {
+    bool keep = false;
+    for (j = 0; j < wanted->n; ++j)
+      if (wanted->v[j].map == NULL &&
+          same_file(&wanted->v[j].st, &pinned->v[i].st)) {
+        free(wanted->v[j].path);
+        wanted->v[j] = pinned->v[i];
+        keep = true;
+        break;
+      }
+    if (!keep)
+      unpin(&pinned->v[i]);
+  }
+
+  for (j = 0; j < wanted->n; ++j) {
+    if (wanted->v[j].map == NULL)
+      pin(&wanted->v[j]);
+    else if (!wanted->v[j].locked)
+      madvise(wanted->v[j].map, wanted->v[j].st.st_size, MADV_WILLNEED);
+  }
+
+  /*
+   * Keep only what actually got pinned.
+   */
+  free(pinned->v);
+  pinned->v = wanted->v;
+  pinned->n = 0;
+  for (j = 0; j < wanted->n; ++j) {
+    if (wanted->v[j].map != NULL)
+      pinned->v[pinned->n++] = wanted->v[j];
+    else
+      free(wanted->v[j].path);
+  }
+  wanted->v = NULL;
+  wanted->n = 0;
+}
+
+static void print_ranking(const struct ranked *v, size_t n) {
+  size_t i;
+  printf("%10s %10s  %s\n", "rate", "launches", "nexe");
+  for (i = 0; i < n; ++i)
+    printf("%10.2f %10llu  %s\n", v[i].rate / (double) ONE_LAUNCH,
+           (unsigned long long) v[i].launches, v[i].path);
+}
+
+static unsigned long long parse_size(const char *s) {
+  char *end;
+  unsigned long long n = strtoull(s, &end, 0);
+  switch (*end) {
+    case 'G':
+      n <<= 10;
+    case 'M':
+      n <<= 10;
+    case 'K':
+      n <<= 10;
+  }
+  return n;
+}
+
+static void request_print(int sig) {
+  print_requested = 1;
+}
+
+/*
+ * Make a datagram socket bound to PATH, replacing a socket there that
+ * nobody's serving any more.
+ */
+static int listen_at(const char *path) {
+  struct sockaddr_un addr;
+  int sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+  if (sock < 0)
+    die("socket");
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    die(path);
+  }
+  strcpy(addr.sun_path, path);
+  if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+    int probe = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (errno != EADDRINUSE || probe < 0 ||
+        connect(probe, (struct sockaddr *) &addr, sizeof(addr)) == 0 ||
+        errno != ECONNREFUSED)
+      die(path);
+    close(probe);
+    if (unlink(path) < 0 ||
+        bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+      die(path);
+  }
+  return sock;
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr, "\
+Usage: %s [-v] [-s SLOTS] [-n TOP] [-b BUDGET] [-i SECONDS] [-C CACHEDIR]\n\
+              SOCKET\n", argv0);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  unsigned long long budget = 256ULL << 20;
+  unsigned long nslots = 1024, top = 16, interval = 10;
+  const char *cachedir = NULL;
+  struct files pinned = { NULL, 0 }, wanted = { NULL, 0 };
+  struct table table;
+  struct sigaction sa;
+  time_t next;
+  int opt, sock;
+
+  while ((opt = getopt(argc, argv, "vs:n:b:i:C:")) != -1) {
+    switch (opt) {
+      case 'v':
+        verbose = 1;
+        break;
+      case 's':
+        nslots = strtoul(optarg, NULL, 0);
+        break;
+      case 'n':
+        top = strtoul(optarg, NULL, 0);
+        break;
+      case 'b':
+        budget = parse_size(optarg);
+        break;
+      case 'i':
+        interval = strtoul(optarg, NULL, 0);
+        break;
+      case 'C':
+        cachedir = optarg;
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  if (argc - optind != 1 || nslots == 0 || nslots > (1UL << 24) ||
+      (nslots & (nslots - 1)) != 0 || interval == 0)
+    usage(argv[0]);
+
+  sock = listen_at(argv[optind]);
+  init_table(&table, nslots);
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = request_print;
+  sigaction(SIGUSR1, &sa, NULL);
+  next = time(NULL) + interval;
+
+  for (;;) {
+    struct pollfd pfd = { sock, POLLIN, 0 };
+    unsigned long long left = budget;
+    uint32_t now;
+    struct ranked *ranked;
+    size_t nranked, i, live;
+    unsigned long nexes;
+    time_t t = time(NULL);
+
+    if (t < next && poll(&pfd, 1, (next - t) * 1000) > 0)
+      take_reports(&table, sock);
+    if (print_requested) {
+      print_requested = 0;
+      ranked = rank(&table, now_seconds(), &nranked);
+      print_ranking(ranked, nranked);
+      fflush(stdout);
+      free(ranked);
+    }
+    if (time(NULL) < next)
+      continue;
+    next = time(NULL) + interval;
+
+    now = now_seconds();
+    ranked = rank(&table, now, &nranked);
+    nexes = 0;
+    for (i = 0; i < nranked && nexes < top && ranked[i].rate > 0; ++i) {
+      size_t first = wanted.n;
+      want(&wanted, ranked[i].path, &ranked[i], &left);
+      if (wanted.n == first)
+        continue;
+      ++nexes;
+      if (cachedir != NULL)
+        want_libraries(&wanted, cachedir, &wanted.v[first].st, &left);
+    }
+    repin(&pinned, &wanted);
+
+    if (table.used > table.nslots / 4 * 3) {
+      uint32_t n = table.nslots;
+      for (live = 0; live < nranked && ranked[live].rate > 0; ++live)
+        continue;
+      if (verbose)
+        fprintf(stderr, "nacl-hotd: %u of %u slots taken, keeping %zu\n",
+                table.used, n, live);
+      rebuild_table(&table, live > n / 2 && n < (1U << 24) ? n * 2 : n,
+                    ranked, live, now);
+    }
+    free(ranked);
+  }
+}
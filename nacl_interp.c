@@ -32,13 +32,75 @@
  *
  * The wrapper script can use the PLATFORM argument to select the
  * appropriate sel_ldr et al to use.
+ *
+ * If NACL_INTERP_TRACE is set in the environment, it names a file to
+ * which a one-line record of each launch is appended before the loader
+ * is run.  The fields, separated by tabs, are:
+ *      TIME PLATFORM ARGC ARGV-BYTES ENVC ENV-BYTES NEXE
+ * TIME is the CLOCK_REALTIME seconds.nanoseconds of the launch; the byte
+ * counts include each string's terminating NUL.  nacl_interp_replay
+ * re-issues a recorded mix of launches for load testing.
+ *
+ * If NACL_INTERP_LDCACHE is set, it names a directory of per-nexe records
+ * made by nacl-ldconfig.  When the nexe has an up-to-date record there,
+ * the environment settings in it (notably NACL_INTERP_LIBRARY_PATH, the
+ * minimal library search path for that nexe) are passed to the loader.
+ * If NACL_INTERP_XATTR is set (to anything), the record is first looked
+ * for in the nexe's own user.nacl.meta extended attribute (nacl-ldconfig
+ * -x), and the directory is only consulted if that's missing or stale.
+ *
+ * A packed nexe (made by nacl-pack) carries the real nexe LZ4-compressed
+ * in its own image.  It is decompressed into a sealed memfd, and NEXE
+ * above is then /proc/self/fd/N rather than the file that was run.
+ *
+ * If NACL_INTERP_PREFETCH is set, it names a directory of lock files
+ * through which concurrent launches of the same nexe agree on one of
+ * them reading the nexe, the loader and the nexe's libraries (per its
+ * metadata record) into the page cache; see prefetch, below.
+ *
+ * If NACL_INTERP_SUPERVISOR is set, it names a program to run instead of
+ * the loader, with the loader's name put before the usual arguments:
+ *      exec ${NACL_INTERP_SUPERVISOR} LOADER PLATFORM NEXE ARGS...
+ * nacl_interp_supervise is such a program; it runs the loader in a
+ * cgroup of its own and reports what the launch cost, and it also keeps
+ * the NACL_INTERP_MIRROR copies of nexes and reports launches to
+ * nacl-hotd.  None of that is worth mapping into every launch.
+ *
+ * If NACL_INTERP_ARGFILE is set to a number of bytes, and ARGS... after
+ * the nexe's argv[0] come to more than that, they are written to a sealed
+ * memfd and replaced by a single argument naming it:
+ *      exec ${NACL_INTERP_LOADER} PLATFORM NEXE ARGV[0] @/proc/self/fd/N
+ * Every later exec then copies just that, and whatever finally runs the
+ * nexe expands it with nacl_expand_argv (see nacl_spawn.h), which maps
+ * the memfd rather than copying again.  Lists too big for a single exec
+ * can get through this way, once past the first.  Since the nexe would
+ * otherwise get that argument as it stands, this only happens when the
+ * loader declares that something down its chain expands it, with a
+ * NACL_ARGV_XATTR_NAME extended attribute on the loader's file.  Neither
+ * nacl_interp_loader_sdk.sh nor stock sel_ldr does; nacl_vcache_standin,
+ * run in sel_ldr's place, does.
  */
 
 #include <elf.h>
+#include <fcntl.h>
 #include <linux/limits.h>
+#include <linux/memfd.h>
 #include <link.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+#include "nacl_interp_start.h"
+#include "nacl_lz4.h"
+
+#ifndef F_ADD_SEALS
+# define F_ADD_SEALS 1033
+# define F_SEAL_SEAL 0x0001
+# define F_SEAL_SHRINK 0x0002
+# define F_SEAL_GROW 0x0004
+# define F_SEAL_WRITE 0x0008
+#endif
 
 /*
  * Get inline functions for system calls.
@@ -47,38 +109,31 @@ static int my_errno;
 #define SYS_ERRNO my_errno
 #include "lss/linux_syscall_support.h"
 
-#define ENVAR "NACL_INTERP_LOADER"
+#define ENVAR NACL_INTERP_ENV_PREFIX "LOADER"
 
-static const char *environ_match(const char *name, const char *envstring) {
-  const char *a = name;
-  const char *b = envstring;
-  while (*a == *b) {
-    if (*a == '\0')
-      return NULL;
-    ++a;
-    ++b;
-  }
-  if (*a == '\0' && *b == '=')
-    return b + 1;
-  return NULL;
-}
-
-static const char *my_getenv(const char *name, const char *const *envp) {
-  const char *const *ep;
-  for (ep = envp; *ep != NULL; ++ep) {
-    const char *match = environ_match(name, *ep);
-    if (match != NULL)
-      return match;
-  }
-  return NULL;
-}
+/*
+ * The stat call that gives full 64-bit device and inode numbers.
+ */
+#if defined(__x86_64__)
+typedef struct kernel_stat nacl_stat_t;
+# define nacl_stat sys_stat
+# define nacl_fstat sys_fstat
+#else
+typedef struct kernel_stat64 nacl_stat_t;
+# define nacl_stat sys_stat64
+# define nacl_fstat sys_fstat64
+#endif
 
-static size_t my_strlen(const char *s) {
-  size_t n = 0;
-  while (*s++ != '\0')
-    ++n;
-  return n;
-}
+/*
+ * System calls newer than our copy of linux_syscall_support.h.  These get
+ * a nacl_ prefix so they can't collide with its own definitions.
+ */
+#define __NR_nacl_getxattr __NR_getxattr
+LSS_INLINE _syscall4(ssize_t, nacl_getxattr, const char *, path,
+                     const char *, name, void *, value, size_t, size)
+#define __NR_nacl_memfd_create __NR_memfd_create
+LSS_INLINE _syscall2(int, nacl_memfd_create, const char *, name,
+                     unsigned int, flags)
 
 /*
  * We're avoiding libc, so no printf.  The only nontrivial thing we need
@@ -102,6 +157,20 @@ static void iov_int_string(int value, struct kernel_iovec *iov,
   iov->iov_len = &buf[bufsz] - p;
 }
 
+/*
+ * Render an unsigned number in decimal, ending just before END and padded
+ * with zeros to at least MIN_DIGITS.  Returns the start of the digits.
+ * This sticks to unsigned long so 32-bit builds need no libgcc division.
+ */
+static char *ulong_string(unsigned long value, char *end, int min_digits) {
+  char *p = end;
+  do {
+    *--p = "0123456789"[value % 10];
+    value /= 10;
+  } while (value != 0 || end - p < min_digits);
+  return p;
+}
+
 #define STRING_IOV(string_constant, cond) \
   { (void *) string_constant, cond ? (sizeof(string_constant) - 1) : 0 }
 
@@ -129,6 +198,364 @@ __attribute__((noreturn)) static void fail(const char *message,
   while (1) *(volatile int *) 0 = 0;  /* Crash.  */
 }
 
+/*
+ * Total the bytes (including NULs) of a NULL-terminated string vector,
+ * storing its length in *COUNT.
+ */
+static size_t string_vector_bytes(const char *const *vec,
+                                  unsigned long *count) {
+  size_t bytes = 0;
+  unsigned long n = 0;
+  for (; *vec != NULL; ++vec, ++n)
+    bytes += my_strlen(*vec) + 1;
+  *count = n;
+  return bytes;
+}
+
+/*
+ * Append a record of this launch to the NACL_INTERP_TRACE file.  The whole
+ * record goes out in a single O_APPEND write so that concurrent launches
+ * don't interleave.  Any failure here is silently ignored: tracing must
+ * never get in the way of actually running the program.
+ */
+static void trace_launch(const char *tracefile, const char *platform,
+                         const char *execfn, const char *const *argv,
+                         const char *const *envp) {
+  static char record[PATH_MAX + 128];
+  char *end = &record[sizeof(record) - 1];
+  char *p = record;
+  char num[32];
+  struct timespec now;
+  unsigned long argc, envc;
+  size_t argv_bytes = string_vector_bytes(argv, &argc);
+  size_t env_bytes = string_vector_bytes(envp, &envc);
+  int fd;
+
+  if (sys_clock_gettime(CLOCK_REALTIME, &now) < 0)
+    now.tv_sec = now.tv_nsec = 0;
+
+#define NUM(value, digits) \
+  ulong_string((value), &num[sizeof(num) - 1], (digits))
+#define PUT(string) \
+  do { \
+    const char *s_ = (string); \
+    while (*s_ != '\0' && p < end) \
+      *p++ = *s_++; \
+  } while (0)
+
+  num[sizeof(num) - 1] = '\0';
+  PUT(NUM(now.tv_sec, 1));
+  PUT(".");
+  PUT(NUM(now.tv_nsec, 9));
+  PUT("\t");
+  PUT(platform);
+  PUT("\t");
+  PUT(NUM(argc, 1));
+  PUT("\t");
+  PUT(NUM(argv_bytes, 1));
+  PUT("\t");
+  PUT(NUM(envc, 1));
+  PUT("\t");
+  PUT(NUM(env_bytes, 1));
+  PUT("\t");
+  PUT(execfn);
+  *p++ = '\n';
+
+#undef PUT
+#undef NUM
+
+  fd = sys_open(tracefile, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+  if (fd >= 0) {
+    sys_write(fd, record, p - record);
+    sys_close(fd);
+  }
+}
+
+/*
+ * Per-nexe metadata records written by nacl-ldconfig, either in the
+ * NACL_INTERP_XATTR extended attribute of the nexe itself or in the
+ * NACL_INTERP_LDCACHE directory; see nacl_nexe_meta.h, which nacl_spawn
+ * uses too.  The launch stats the nexe once, for that and for prefetch.
+ */
+typedef nacl_stat_t nacl_meta_stat_t;
+#define META_MTIME(st) ((st)->st_mtime_)
+#define META_MTIME_NSEC(st) ((st)->st_mtime_nsec_)
+#define meta_getxattr sys_nacl_getxattr
+#define meta_open(path) sys_open((path), O_RDONLY | O_CLOEXEC, 0)
+#define meta_read sys_read
+#define meta_close sys_close
+#include "nacl_nexe_meta.h"
+
+static char metadata_record[NACL_RECORD_SIZE];
+static size_t metadata_size;
+
+/*
+ * Cold-start prefetching (NACL_INTERP_PREFETCH).  The nexe, the loader
+ * and every library in the nexe's metadata record ("needed NAME PATH"
+ * lines) are read into the page cache before the loader starts.
+ *
+ * When a burst of launches of one nexe arrive together, only the first
+ * should do that I/O.  So launches coordinate through a lock file named
+ * for the nexe's identity in the NACL_INTERP_PREFETCH directory.  Whoever
+ * gets the lock exclusively does the reading, then leaves the nexe's
+ * stamp in the file to say it's done.  Anyone who finds the lock taken
+ * waits up to PREFETCH_WAIT_MS for that to finish, then goes ahead
+ * without reading anything.  A stamp older than PREFETCH_FRESH_SECONDS
+ * is ignored, since the pages may since have been evicted.
+ */
+#define PREFETCH_WAIT_MS 100
+#define PREFETCH_FRESH_SECONDS 60
+
+static void prefetch_file(const char *file) {
+  nacl_stat_t st;
+  int fd = sys_open(file, O_RDONLY | O_CLOEXEC, 0);
+  if (fd < 0)
+    return;
+  if (nacl_fstat(fd, &st) == 0 && st.st_size > 0 &&
+      (size_t) st.st_size == st.st_size) {
+    void *p = sys_mmap(NULL, st.st_size, PROT_READ,
+                       MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (p != (void *) -1)
+      sys_munmap(p, st.st_size);
+  }
+  sys_close(fd);
+}
+
+static void prefetch_files(const char *execfn, const char *loader) {
+  static const char needed[] = "needed ";
+  const char *p = metadata_record;
+  const char *end = metadata_record + metadata_size;
+
+  prefetch_file(execfn);
+  prefetch_file(loader);
+
+  /*
+   * parse_record left each complete line NUL-terminated.
+   */
+  while (p < end) {
+    const char *line = p;
+    size_t i;
+    while (p < end && *p != '\0')
+      ++p;
+    if (p == end)
+      break;
+    ++p;
+    for (i = 0; i < sizeof(needed) - 1 && line[i] == needed[i]; ++i)
+      continue;
+    if (i == sizeof(needed) - 1) {
+      line += i;
+      while (*line != ' ' && *line != '\0')
+        ++line;
+      if (*line == ' ')
+        prefetch_file(line + 1);
+    }
+  }
+}
+
+static bool recently_prefetched(int fd, const char *stamp) {
+  char contents[NACL_STAMP_SIZE];
+  struct timespec now;
+  nacl_stat_t st;
+  ssize_t n = sys_read(fd, contents, sizeof(contents) - 1);
+  size_t i;
+
+  if (n <= 0 || nacl_fstat(fd, &st) < 0 ||
+      sys_clock_gettime(CLOCK_REALTIME, &now) < 0 ||
+      now.tv_sec - st.st_mtime_ > PREFETCH_FRESH_SECONDS)
+    return false;
+  contents[n] = '\0';
+  for (i = 0; stamp[i] != '\0' && stamp[i] == contents[i]; ++i)
+    continue;
+  return stamp[i] == '\0' && contents[i] == '\0';
+}
+
+static void prefetch(const char *dir, const char *execfn,
+                     const nacl_stat_t *st, const char *loader) {
+  char path[PATH_MAX];
+  char stamp[NACL_STAMP_SIZE];
+  int fd, i;
+
+  if (!identity_path(path, dir, st))
+    return;
+  fd = sys_open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (fd < 0) {
+    prefetch_files(execfn, loader);
+    return;
+  }
+
+  if (sys_flock(fd, LOCK_EX | LOCK_NB) == 0) {
+    format_stamp(stamp, st->st_dev, st->st_ino,
+                 st->st_mtime_, st->st_mtime_nsec_, st->st_size);
+    if (!recently_prefetched(fd, stamp)) {
+      prefetch_files(execfn, loader);
+      if (sys_ftruncate(fd, 0) == 0 && sys_lseek(fd, 0, SEEK_SET) == 0)
+        sys_write(fd, stamp, my_strlen(stamp));
+    }
+  } else {
+    struct timespec millisecond = { 0, 1000000 };
+    for (i = 0; i < PREFETCH_WAIT_MS; ++i) {
+      if (sys_flock(fd, LOCK_SH | LOCK_NB) == 0)
+        break;
+      sys_nanosleep(&millisecond, NULL);
+    }
+  }
+
+  sys_close(fd);
+}
+
+/*
+ * Write /proc/self/fd/FD at P, NUL-terminated, and return P.  P needs
+ * sizeof("/proc/self/fd/") + 10 bytes.
+ */
+static char *fd_path(char *p, int fd) {
+  char num[16];
+  char *start = p;
+  const char *s;
+
+  for (s = "/proc/self/fd/"; *s != '\0'; ++s)
+    *p++ = *s;
+  num[sizeof(num) - 1] = '\0';
+  for (s = ulong_string(fd, &num[sizeof(num) - 1], 1); *s != '\0'; ++s)
+    *p++ = *s;
+  *p = '\0';
+  return start;
+}
+
+/*
+ * If the nexe is packed (see nacl_lz4.h), decompress the real one into a
+ * sealed memfd and return a name for it the loader can open; otherwise
+ * just return EXECFN.  The payload is already mapped, since the kernel
+ * loaded the whole shell, so it's found through our program headers
+ * rather than by reading the file.  The memfd is deliberately left open
+ * across the exec.
+ */
+static const char *unpack_nexe(const struct nacl_startup *info,
+                               const char *execfn) {
+  static char fdname[sizeof("/proc/self/fd/") + 16];
+  const ElfW(Phdr) *self = NULL;
+  const ElfW(Phdr) *packed = NULL;
+  const struct nacl_packed_header *header;
+  uint8_t *image;
+  size_t i;
+  int fd;
+
+  for (i = 0; i < info->phnum; ++i)
+    if (info->phdr[i].p_type == PT_PHDR)
+      self = &info->phdr[i];
+    else if (info->phdr[i].p_type == PT_NACL_PACKED)
+      packed = &info->phdr[i];
+  if (packed == NULL)
+    return execfn;
+
+  if (self == NULL || packed->p_filesz < sizeof(*header))
+    fail("malformed packed nexe ", execfn, NULL, 0);
+  header = (const struct nacl_packed_header *)
+      ((uintptr_t) info->phdr - self->p_vaddr + packed->p_vaddr);
+  for (i = 0; i < sizeof(NACL_PACKED_MAGIC); ++i)
+    if (header->magic[i] != NACL_PACKED_MAGIC[i])
+      fail("malformed packed nexe ", execfn, NULL, 0);
+  if (header->compressed_size > packed->p_filesz - sizeof(*header) ||
+      header->size != (size_t) header->size)
+    fail("malformed packed nexe ", execfn, NULL, 0);
+
+  fd = sys_nacl_memfd_create("nacl-nexe", MFD_ALLOW_SEALING);
+  if (fd < 0)
+    fail("cannot create memfd for ", execfn, "errno", my_errno);
+  if (sys_ftruncate(fd, header->size) < 0)
+    fail("cannot size memfd for ", execfn, "errno", my_errno);
+  image = sys_mmap(NULL, header->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fd, 0);
+  if (image == (void *) -1)
+    fail("cannot map memfd for ", execfn, "errno", my_errno);
+  if (lz4_decompress((const uint8_t *) (header + 1), header->compressed_size,
+                     image, header->size) != (ptrdiff_t) header->size)
+    fail("corrupt packed nexe ", execfn, NULL, 0);
+  sys_munmap(image, header->size);
+  if (sys_fcntl(fd, F_ADD_SEALS,
+                F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE) < 0)
+    fail("cannot seal memfd for ", execfn, "errno", my_errno);
+
+  return fd_path(fdname, fd);
+}
+
+/*
+ * Parse NACL_INTERP_ARGFILE's byte count.  Anything but plain decimal
+ * digits leaves the mode off.
+ */
+static bool parse_threshold(const char *value, size_t *threshold) {
+  size_t n = 0;
+  if (*value == '\0')
+    return false;
+  for (; *value != '\0'; ++value) {
+    if (*value < '0' || *value > '9')
+      return false;
+    n = n * 10 + (*value - '0');
+  }
+  *threshold = n;
+  return true;
+}
+
+/*
+ * For NACL_INTERP_ARGFILE: if the arguments after ARGV[0] come to more
+ * than THRESHOLD bytes, and LOADER declares that it expands a reference
+ * to them, write them to a sealed memfd and fill SHORT_ARGV with ARGV[0],
+ * the reference, and a NULL.  The kernel leaves the strings packed
+ * together, so this is one write; a vector that isn't packed is left
+ * alone.
+ */
+static bool write_argfile(const char *loader, const char *const *argv,
+                          int argc, size_t threshold,
+                          const char *short_argv[3]) {
+  static char ref[sizeof(NACL_ARGV_REF_PREFIX) + 16];
+  const char *end;
+  int fd, i;
+
+  if (argc < 2)
+    return false;
+  end = argv[1];
+  for (i = 1; i < argc; ++i) {
+    if (argv[i] != end)
+      return false;
+    end += my_strlen(end) + 1;
+  }
+  if ((size_t) (end - argv[1]) <= threshold ||
+      sys_nacl_getxattr(loader, NACL_ARGV_XATTR_NAME, NULL, 0) < 0)
+    return false;
+
+  fd = sys_nacl_memfd_create(NACL_ARGV_MEMFD_NAME, MFD_ALLOW_SEALING);
+  if (fd < 0)
+    fail("cannot create memfd for arguments", NULL, "errno", my_errno);
+  if (sys_write(fd, argv[1], end - argv[1]) != end - argv[1] ||
+      sys_fcntl(fd, F_ADD_SEALS,
+                F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE) < 0)
+    fail("cannot write arguments to memfd", NULL, "errno", my_errno);
+
+  ref[0] = '@';
+  fd_path(&ref[1], fd);
+  short_argv[0] = argv[0];
+  short_argv[1] = ref;
+  short_argv[2] = NULL;
+  return true;
+}
+
+/*
+ * Space for a new argument or environment vector of N slots.  Usual
+ * sizes fit in BUF, of BUFSIZE slots.  Bigger ones get pages of their
+ * own, as a stack frame sized by the caller's arguments could run right
+ * off the end of the stack.
+ */
+static const char **vector_space(const char **buf, size_t bufsize,
+                                 size_t n) {
+  void *p;
+  if (n <= bufsize)
+    return buf;
+  p = sys_mmap(NULL, n * sizeof(*buf), PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == (void *) -1)
+    fail("cannot allocate argument space", NULL, "errno", my_errno);
+  return p;
+}
+
 /*
  * This declaration tells the compiler that there is a caller even though
  * it can't see it in the C code.  It also specifies the symbol name to use
@@ -141,37 +568,13 @@ static void do_start(uintptr_t *stack) asm("do_start")
     __attribute__((noreturn, used));
 
 static void do_start(uintptr_t *stack) {
-  /*
-   * First find the end of the auxiliary vector.
-   */
-  int argc = stack[0];
-  const char *const *argv = (const char *const *) &stack[1];
-  const char *const *envp = &argv[argc + 1];
-  const char *const *ep = envp;
-  while (*ep != NULL)
-    ++ep;
-  ElfW(auxv_t) *auxv = (ElfW(auxv_t) *) (ep + 1);
-  ElfW(auxv_t) *av = auxv;
-  while (av->a_type != AT_NULL)
-    ++av;
-
-  const char *execfn = NULL;
-  const char *platform = NULL;
-  bool secure = true;
-
-  for (av = auxv; av->a_type != AT_NULL; ++av)
-    switch (av->a_type) {
-      case AT_EXECFN:
-        execfn = (const char *) av->a_un.a_val;
-        break;
-      case AT_PLATFORM:
-        platform = (const char *) av->a_un.a_val;
-        break;
-      case AT_SECURE:
-        secure = av->a_un.a_val != 0;
-        break;
-    }
+  struct nacl_startup info;
+  const char *execfn;
+  const char *platform;
+
+  parse_stack(stack, &info);
 
+  execfn = info.execfn;
   if (execfn == NULL) {
     static char buf[PATH_MAX + 1];
     ssize_t n = sys_readlink("/proc/self/exe", buf, sizeof buf - 1);
@@ -179,45 +582,79 @@ static void do_start(uintptr_t *stack) {
       buf[n] = '\0';
       execfn = buf;
     } else {
-      execfn = argv[0];
+      execfn = info.argv[0];
     }
   }
 
-  if (secure)
+  if (info.secure)
     fail("refusing secure exec of ", execfn, NULL, 0);
 
-  if (platform == NULL) {
-#if defined(__x86_64__)
-    platform = "x86_64";
-#elif defined(__i386__)
-    platform = "i386";
-#elif defined(__arm__)
-    platform = "arm";
-#elif defined(__mips__)
-    platform = "mips";
-#else
-# error "Don't know default platform!"
-#endif
-  }
+  platform = info.platform;
+  if (platform == NULL)
+    platform = default_platform();
 
   {
-    const char *loader = my_getenv(ENVAR, envp);
-    const char *new_argv[argc + 4];
-    int i;
+    const char *loader = info.env.loader;
+    const char *program = loader;
+    const char *const *argv = info.argv;
+    int argc = info.argc;
+    const char *short_argv[3];
+    const char *argv_buf[64];
+    const char *envp_buf[128];
+    const char **new_argv;
+    const char *exports[NACL_MAX_EXPORTS];
+    int nexports = -1;
+    size_t threshold;
+    nacl_stat_t st;
 
     if (loader == NULL)
       fail("environment variable " ENVAR
            " must be set to run a NaCl binary directly", NULL, NULL, 0);
 
-    new_argv[0] = loader;
-    new_argv[1] = platform;
-    new_argv[2] = execfn;
-    for (i = 1; i <= argc; ++i)
-      new_argv[2 + i] = argv[i];
+    if (info.env.trace != NULL)
+      trace_launch(info.env.trace, platform, execfn, info.argv, info.envp);
+
+    if ((info.env.xattr != NULL || info.env.ldcache != NULL ||
+         info.env.prefetch != NULL) && nacl_stat(execfn, &st) == 0) {
+      nexports = read_metadata(info.env.xattr, info.env.ldcache, execfn, &st,
+                               metadata_record, &metadata_size, exports);
+      if (info.env.prefetch != NULL)
+        prefetch(info.env.prefetch, execfn, &st, loader);
+    }
+
+    execfn = unpack_nexe(&info, execfn);
+
+    if (info.env.argfile != NULL &&
+        parse_threshold(info.env.argfile, &threshold) &&
+        write_argfile(loader, argv, argc, threshold, short_argv)) {
+      argv = short_argv;
+      argc = 2;
+    }
+
+    new_argv = vector_space(argv_buf, sizeof(argv_buf) / sizeof(argv_buf[0]),
+                            loader_argv_size(argc) + 1);
+    if (info.env.supervisor == NULL) {
+      build_loader_argv(new_argv, loader, platform, execfn, argc, argv);
+    } else {
+      const char *prefix[3];
+      program = prefix[0] = info.env.supervisor;
+      prefix[1] = loader;
+      prefix[2] = platform;
+      build_command_argv(new_argv, prefix, 3, execfn, argc, argv);
+    }
 
-    sys_execve(loader, (const char *const *) new_argv, envp);
+    if (nexports <= 0) {
+      sys_execve(program, (const char *const *) new_argv, info.envp);
+    } else {
+      const char **new_envp =
+          vector_space(envp_buf, sizeof(envp_buf) / sizeof(envp_buf[0]),
+                       info.envc + nexports + 1);
+      build_loader_envp(new_envp, info.envp, exports, nexports);
+      sys_execve(program, (const char *const *) new_argv,
+                 (const char *const *) new_envp);
+    }
 
-    fail("failed to execute ", loader, "errno", my_errno);
+    fail("failed to execute ", program, "errno", my_errno);
   }
 }
 
@@ -0,0 +1,394 @@
+/*
+ * Copyright (c) 2011 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * In-process microbenchmarks for nacl_interp's startup code.
+ *
+ * Usage: nacl_interp_bench [SUITE...]
+ *
+ * Each suite builds synthetic inputs of various shapes, checks once that
+ * the interp code produces the right answers for them (aborting if not),
+ * and then times it over enough iterations to take a fraction of a second.
+ * With no arguments, all suites are run.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nacl_interp_start.h"
+
+#define LOADER_VAR "NACL_INTERP_LOADER"
+
+/*
+ * Keeps results alive so the compiler can't discard the work being timed.
+ */
+static volatile uintptr_t sink;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void check(int ok, const char *what, const char *shape) {
+  if (!ok) {
+    fprintf(stderr, "nacl_interp_bench: %s: wrong %s\n", shape, what);
+    exit(1);
+  }
+}
+
+/*
+ * Run FN(ARG) repeatedly, doubling the count until a batch takes at least
+ * a fifth of a second, and report the per-iteration cost.
+ */
+static void time_it(const char *suite, const char *shape,
+                    void (*fn)(void *), void *arg) {
+  unsigned long iterations = 1, i;
+  double elapsed;
+
+  for (;;) {
+    double start = now();
+    for (i = 0; i < iterations; ++i)
+      fn(arg);
+    elapsed = now() - start;
+    if (elapsed >= 0.2)
+      break;
+    iterations *= 2;
+  }
+
+  printf("%-8s %-28s %12.1f ns/iter %12.3f Miter/s\n", suite, shape,
+         elapsed / iterations * 1e9, iterations / elapsed / 1e6);
+}
+
+/*
+ * A synthetic initial stack image, laid out just as the kernel does it.
+ */
+struct stack_image {
+  const char *shape;
+  uintptr_t *words;
+  int argc;
+  int envc;
+  const char **new_argv;
+};
+
+static char *xstrdup_printf(const char *format, unsigned long n) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), format, n);
+  return strdup(buf);
+}
+
+static void make_stack(struct stack_image *image, const char *shape,
+                       int argc, int envc, int auxc) {
+  size_t nwords = 1 + argc + 1 + envc + 1 + 2 * (auxc + 4) + 2;
+  uintptr_t *w = calloc(nwords, sizeof(*w));
+  int i;
+
+  image->shape = shape;
+  image->words = w;
+  image->argc = argc;
+  image->envc = envc;
+  image->new_argv = calloc(loader_argv_size(argc), sizeof(char *));
+
+  *w++ = argc;
+  for (i = 0; i < argc; ++i)
+    *w++ = (uintptr_t) xstrdup_printf("arg%lu", i);
+  *w++ = 0;
+
+  /*
+   * Put the variable we look for last, so the lookup is worst-case.
+   */
+  for (i = 0; i < envc - 1; ++i)
+    *w++ = (uintptr_t) xstrdup_printf("SOME_VARIABLE_%lu=some value", i);
+  *w++ = (uintptr_t) LOADER_VAR "=/usr/bin/nacl_interp_loader.sh";
+  *w++ = 0;
+
+  for (i = 0; i < auxc; ++i) {
+    *w++ = AT_IGNORE;
+    *w++ = i;
+  }
+  *w++ = AT_SECURE;
+  *w++ = 0;
+  *w++ = AT_PLATFORM;
+  *w++ = (uintptr_t) "x86_64";
+  *w++ = AT_EXECFN;
+  *w++ = (uintptr_t) "/path/to/some.nexe";
+  *w++ = AT_PAGESZ;
+  *w++ = 4096;
+  *w++ = AT_NULL;
+  *w++ = 0;
+}
+
+/*
+ * Everything do_start does short of system calls.
+ */
+static void parse_and_build(void *arg) {
+  struct stack_image *image = arg;
+  struct nacl_startup info;
+  const char *loader;
+
+  parse_stack(image->words, &info);
+  loader = info.env.loader;
+  build_loader_argv(image->new_argv, loader,
+                    info.platform != NULL ? info.platform : default_platform(),
+                    info.execfn, info.argc, info.argv);
+  sink = (uintptr_t) image->new_argv[2];
+}
+
+static void check_stack(struct stack_image *image) {
+  int i;
+
+  parse_and_build(image);
+
+  check(!strcmp(image->new_argv[0], "/usr/bin/nacl_interp_loader.sh"),
+        "loader", image->shape);
+  check(!strcmp(image->new_argv[1], "x86_64"), "platform", image->shape);
+  check(!strcmp(image->new_argv[2], "/path/to/some.nexe"), "execfn",
+        image->shape);
+  check(my_strlen(image->new_argv[2]) == strlen(image->new_argv[2]),
+        "execfn length", image->shape);
+  for (i = 1; i < image->argc; ++i)
+    check(image->new_argv[2 + i] == (const char *) image->words[1 + i],
+          "argv", image->shape);
+  check(image->new_argv[2 + image->argc] == NULL, "argv terminator",
+        image->shape);
+}
+
+static void bench_parse(void) {
+  static const struct {
+    const char *shape;
+    int argc, envc, auxc;
+  } shapes[] = {
+    { "typical (4 argv, 40 env)", 4, 40, 20 },
+    { "argv 100k", 100000, 40, 20 },
+    { "env 10k", 4, 10000, 20 },
+    { "auxv 1k", 4, 40, 1000 },
+    { "argv 100k, env 10k", 100000, 10000, 20 },
+  };
+  size_t i;
+
+  for (i = 0; i < sizeof(shapes) / sizeof(shapes[0]); ++i) {
+    struct stack_image image;
+    make_stack(&image, shapes[i].shape,
+               shapes[i].argc, shapes[i].envc, shapes[i].auxc);
+    check_stack(&image);
+    time_it("parse", image.shape, parse_and_build, &image);
+  }
+}
+
+/*
+ * The straightforward versions the word-at-a-time code replaced, as the
+ * baseline: one full pass over the environment per variable looked up.
+ */
+static const char *bytewise_getenv(const char *name, const char *const *envp) {
+  const char *const *ep;
+  for (ep = envp; *ep != NULL; ++ep) {
+    const char *match = environ_match(name, *ep);
+    if (match != NULL)
+      return match;
+  }
+  return NULL;
+}
+
+static size_t bytewise_strlen(const char *s) {
+  size_t n = 0;
+  while (*s++ != '\0')
+    ++n;
+  return n;
+}
+
+/*
+ * Every variable scan_variable knows, and where it puts each.
+ */
+static const struct {
+  const char *name;
+  size_t field;
+} env_variables[] = {
+  { "NACL_INTERP_LOADER", offsetof(struct nacl_interp_env, loader) },
+  { "NACL_INTERP_TRACE", offsetof(struct nacl_interp_env, trace) },
+  { "NACL_INTERP_LDCACHE", offsetof(struct nacl_interp_env, ldcache) },
+  { "NACL_INTERP_XATTR", offsetof(struct nacl_interp_env, xattr) },
+  { "NACL_INTERP_SUPERVISOR", offsetof(struct nacl_interp_env, supervisor) },
+  { "NACL_INTERP_PREFETCH", offsetof(struct nacl_interp_env, prefetch) },
+  { "NACL_INTERP_ARGFILE", offsetof(struct nacl_interp_env, argfile) },
+};
+#define NUM_ENV_VARIABLES (sizeof(env_variables) / sizeof(env_variables[0]))
+
+/*
+ * Check scan_variable on SAMPLE, placed so it ends ALIGN bytes before the
+ * inaccessible page at GUARD, against bytewise_getenv for each variable.
+ */
+static void check_sample(char *guard, const char *sample, size_t align) {
+  size_t len = strlen(sample), i;
+  char *s = guard - len - 1 - align;
+  const char *envp[2] = { s, NULL };
+  struct nacl_interp_env env;
+
+  memcpy(s, sample, len + 1);
+  check(my_strlen(s) == len, "length", sample);
+
+  clear_env(&env);
+  scan_variable(s, &env);
+  for (i = 0; i < NUM_ENV_VARIABLES; ++i) {
+    const char *got = *(const char **) ((char *) &env +
+                                        env_variables[i].field);
+    check(got == bytewise_getenv(env_variables[i].name, envp),
+          env_variables[i].name, sample);
+  }
+}
+
+/*
+ * Check the string scanning near an inaccessible page, at every alignment,
+ * so that any read past the end of a string would fault.  Each variable
+ * is tried as itself, without and with an empty value, and with its name
+ * one character short or long, so a name that's a prefix of another's
+ * (or of a variable's) is never taken for it.
+ */
+static void check_scanning(void) {
+  static const char *const samples[] = {
+    "", "N", "NACL_", "NACL_INTER", "NACL_INTERP_", "NACL_INTERP_=/x",
+    "NACL_INTERP_L", "NACL_INTERP_LD", "NACL_INTERPX_TRACE=/t",
+    "nacl_interp_loader=/x", "PATH=/usr/bin:/bin",
+  };
+  static const char *const shapes[] = {
+    "%s", "%s=", "%s=/v", "%sS=/v",
+  };
+  long pagesize = sysconf(_SC_PAGESIZE);
+  char *pages = mmap(NULL, 2 * pagesize, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  char sample[64];
+  size_t i, j, align;
+
+  check(pages != MAP_FAILED, "mmap", "scanning");
+  check(mprotect(pages + pagesize, pagesize, PROT_NONE) == 0,
+        "mprotect", "scanning");
+
+  for (align = 0; align < 2 * WORD_SIZE; ++align) {
+    for (i = 0; i < sizeof(samples) / sizeof(samples[0]); ++i)
+      check_sample(pages + pagesize, samples[i], align);
+    for (i = 0; i < NUM_ENV_VARIABLES; ++i) {
+      const char *name = env_variables[i].name;
+      for (j = 0; j < sizeof(shapes) / sizeof(shapes[0]); ++j) {
+        snprintf(sample, sizeof(sample), shapes[j], name);
+        check_sample(pages + pagesize, sample, align);
+      }
+      snprintf(sample, sizeof(sample), "%.*s=/v", (int) strlen(name) - 1,
+               name);
+      check_sample(pages + pagesize, sample, align);
+    }
+  }
+
+  munmap(pages, 2 * pagesize);
+}
+
+struct env_image {
+  const char **envp;
+  int lookups;
+};
+
+/*
+ * A CI-sized environment with nothing of ours in it until the very end.
+ */
+static const char **make_environment(int envc) {
+  const char **envp = calloc(envc + 1, sizeof(envp[0]));
+  int i;
+
+  for (i = 0; i < envc - 1; ++i)
+    envp[i] = xstrdup_printf("SOME_RATHER_LONG_VARIABLE_NAME_%lu="
+                             "/some/fairly/long/value", i);
+  envp[envc - 1] = LOADER_VAR "=/usr/bin/nacl_interp_loader.sh";
+  return envp;
+}
+
+static void env_bytewise(void *arg) {
+  struct env_image *image = arg;
+  int i;
+  for (i = 0; i < image->lookups; ++i)
+    sink = (uintptr_t) bytewise_getenv(LOADER_VAR, image->envp);
+}
+
+static void env_scan(void *arg) {
+  struct env_image *image = arg;
+  struct nacl_interp_env env;
+  const char *const *ep;
+
+  clear_env(&env);
+  for (ep = image->envp; *ep != NULL; ++ep)
+    scan_variable(*ep, &env);
+  sink = (uintptr_t) env.loader;
+}
+
+static void strlen_bytewise(void *arg) {
+  const char *const *ep;
+  size_t total = 0;
+  for (ep = arg; *ep != NULL; ++ep)
+    total += bytewise_strlen(*ep);
+  sink = total;
+}
+
+static void strlen_words(void *arg) {
+  const char *const *ep;
+  size_t total = 0;
+  for (ep = arg; *ep != NULL; ++ep)
+    total += my_strlen(*ep);
+  sink = total;
+}
+
+static void bench_env(void) {
+  struct env_image image;
+  char shape[64];
+  int lookups;
+
+  check_scanning();
+
+  image.envp = make_environment(10000);
+  image.lookups = 1;
+  for (lookups = 1; lookups <= 8; lookups *= 2) {
+    image.lookups = lookups;
+    snprintf(shape, sizeof(shape), "env 10k, bytewise x%d", lookups);
+    time_it("env", shape, env_bytewise, &image);
+  }
+  time_it("env", "env 10k, single scan", env_scan, &image);
+
+  time_it("env", "env 10k, bytewise strlen", strlen_bytewise, image.envp);
+  time_it("env", "env 10k, word strlen", strlen_words, image.envp);
+}
+
+static const struct {
+  const char *name;
+  void (*run)(void);
+} suites[] = {
+  { "parse", bench_parse },
+  { "env", bench_env },
+};
+
+int main(int argc, char **argv) {
+  size_t i;
+  int arg;
+
+  if (argc == 1) {
+    for (i = 0; i < sizeof(suites) / sizeof(suites[0]); ++i)
+      suites[i].run();
+    return 0;
+  }
+
+  for (arg = 1; arg < argc; ++arg) {
+    for (i = 0; i < sizeof(suites) / sizeof(suites[0]); ++i)
+      if (!strcmp(argv[arg], suites[i].name))
+        break;
+    if (i == sizeof(suites) / sizeof(suites[0])) {
+      fprintf(stderr, "nacl_interp_bench: unknown suite \"%s\"\n", argv[arg]);
+      return 2;
+    }
+    suites[i].run();
+  }
+
+  return 0;
+}
@@ -0,0 +1,280 @@
+/*
+ * Copyright (c) 2011 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Measure a cold burst of concurrent launches of one nexe, with and
+ * without NACL_INTERP_PREFETCH's single-flight warming (see nacl_interp.c).
+ *
+ * Usage: nacl_interp_burst [-n COUNT] [-r ROUNDS] NEXE
+ *
+ * NEXE must have a PT_INTERP naming the ld-nacl-*.so.1 under test, and
+ * should be about as big as the real nexes in question.  For each of
+ * ROUNDS rounds (default 5) and each mode, NEXE is dropped from the page
+ * cache, and then COUNT (default 100) launches of it are released at once.
+ * The loader they run is this program again, standing in for sel_ldr by
+ * mapping the whole nexe, touching each page, and exiting.  Latency is
+ * from the release to each launch's exit.  With single-flight, each round
+ * gets a fresh lock directory so that earlier rounds' stamps don't count.
+ *
+ * Dropping the pages uses POSIX_FADV_DONTNEED, which needs no privilege
+ * but leaves any page something still has mapped; nothing should be
+ * using NEXE while this runs.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOADER_MARK "NACL_INTERP_BURST_LOADER"
+
+extern char **environ;
+
+/*
+ * Keeps the stand-in loader's page touches from being optimized away.
+ */
+static volatile char sink;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Run as the loader: PLATFORM NEXE ARGS...  Like sel_ldr, this maps the
+ * nexe rather than reading it, and then touches every page of it.
+ */
+static int stand_in_loader(int argc, char **argv) {
+  const char *image;
+  struct stat st;
+  off_t i;
+  int fd;
+
+  if (argc < 3)
+    return 127;
+  fd = open(argv[2], O_RDONLY | O_CLOEXEC);
+  if (fd < 0 || fstat(fd, &st) < 0)
+    return 127;
+  image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (image == MAP_FAILED)
+    return 127;
+  for (i = 0; i < st.st_size; i += 4096)
+    sink = image[i];
+  return 0;
+}
+
+static void evict(const char *file) {
+  int fd = open(file, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    perror(file);
+    exit(1);
+  }
+  fdatasync(fd);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+}
+
+static void remove_lockdir(const char *dir) {
+  DIR *d = opendir(dir);
+  struct dirent *entry;
+  if (d != NULL) {
+    while ((entry = readdir(d)) != NULL)
+      if (entry->d_name[0] != '.')
+        unlinkat(dirfd(d), entry->d_name, 0);
+    closedir(d);
+  }
+  if (rmdir(dir) < 0)
+    perror(dir);
+}
+
+static int compare_double(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+static double percentile(const double *sorted, size_t n, double pct) {
+  size_t i;
+  if (n == 0)
+    return 0;
+  i = (size_t) (pct / 100.0 * (n - 1) + 0.5);
+  return sorted[i];
+}
+
+/*
+ * Build the launches' environment: ours, plus the stand-in loader, plus
+ * NACL_INTERP_PREFETCH if LOCKDIR isn't NULL.
+ */
+static char **make_environment(const char *self, const char *lockdir) {
+  size_t n = 0, i;
+  char **envp;
+
+  while (environ[n] != NULL)
+    ++n;
+  envp = calloc(n + 4, sizeof(envp[0]));
+  if (envp == NULL) {
+    perror("calloc");
+    exit(1);
+  }
+  for (i = 0; i < n; ++i)
+    envp[i] = environ[i];
+  if (asprintf(&envp[n++], "NACL_INTERP_LOADER=%s", self) < 0 ||
+      (lockdir != NULL &&
+       asprintf(&envp[n++], "NACL_INTERP_PREFETCH=%s", lockdir) < 0)) {
+    perror("asprintf");
+    exit(1);
+  }
+  envp[n++] = (char *) LOADER_MARK "=1";
+  return envp;
+}
+
+/*
+ * Release COUNT launches at once and fill LATENCIES as they finish.
+ * Returns the number that failed.
+ */
+static unsigned long burst(const char *nexe, char **envp, unsigned long count,
+                           double *latencies) {
+  char *const argv[] = { (char *) nexe, NULL };
+  unsigned long i, failures = 0;
+  double start;
+  int gate[2];
+
+  if (pipe(gate) < 0) {
+    perror("pipe");
+    exit(1);
+  }
+  for (i = 0; i < count; ++i) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      exit(1);
+    }
+    if (pid == 0) {
+      char c;
+      close(gate[1]);
+      if (read(gate[0], &c, 1) < 0)
+        _exit(127);
+      close(gate[0]);
+      execve(nexe, argv, envp);
+      _exit(127);
+    }
+  }
+
+  close(gate[0]);
+  start = now();
+  close(gate[1]);
+
+  for (i = 0; i < count; ++i) {
+    int status;
+    if (wait(&status) < 0) {
+      perror("wait");
+      exit(1);
+    }
+    latencies[i] = now() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      ++failures;
+  }
+  return failures;
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s [-n COUNT] [-r ROUNDS] NEXE\n", argv0);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  static const char *const modes[] = { "no prefetch", "single-flight" };
+  unsigned long count = 100, rounds = 5, round, failures = 0;
+  char self[4096];
+  double *latencies[2];
+  const char *nexe;
+  size_t mode;
+  ssize_t n;
+  int opt;
+
+  if (getenv(LOADER_MARK) != NULL)
+    return stand_in_loader(argc, argv);
+
+  while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+    switch (opt) {
+      case 'n':
+        count = strtoul(optarg, NULL, 0);
+        break;
+      case 'r':
+        rounds = strtoul(optarg, NULL, 0);
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  if (argc - optind != 1 || count == 0 || rounds == 0)
+    usage(argv[0]);
+  nexe = argv[optind];
+
+  n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+  if (n < 0) {
+    perror("/proc/self/exe");
+    return 1;
+  }
+  self[n] = '\0';
+
+  for (mode = 0; mode < 2; ++mode) {
+    latencies[mode] = calloc(count * rounds, sizeof(double));
+    if (latencies[mode] == NULL) {
+      perror("calloc");
+      return 1;
+    }
+  }
+
+  /*
+   * Alternate the modes so that drift in the machine's state hits both.
+   */
+  for (round = 0; round < rounds; ++round) {
+    for (mode = 0; mode < 2; ++mode) {
+      char lockdir[] = "/tmp/nacl_interp_burst.XXXXXX";
+      char **envp;
+
+      if (mode == 1 && mkdtemp(lockdir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+      }
+      envp = make_environment(self, mode == 1 ? lockdir : NULL);
+      evict(nexe);
+      failures += burst(nexe, envp, count,
+                        &latencies[mode][round * count]);
+      free(envp);
+
+      if (mode == 1)
+        remove_lockdir(lockdir);
+    }
+  }
+
+  printf("%lu rounds of %lu concurrent launches of %s\n",
+         rounds, count, nexe);
+  printf("%-14s %10s %10s %10s\n", "mode", "p50 ms", "p99 ms", "max ms");
+  for (mode = 0; mode < 2; ++mode) {
+    size_t total = count * rounds;
+    qsort(latencies[mode], total, sizeof(double), compare_double);
+    printf("%-14s %10.3f %10.3f %10.3f\n", modes[mode],
+           percentile(latencies[mode], total, 50) * 1e3,
+           percentile(latencies[mode], total, 99) * 1e3,
+           latencies[mode][total - 1] * 1e3);
+  }
+  if (failures != 0)
+    printf("%lu launches failed\n", failures);
+
+  return failures != 0;
+}
@@ -0,0 +1,74 @@
+#!/bin/sh
+# Copyright (c) 2011 The Native Client Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+#
+# Usage: nacl_interp_check.sh INTERP BUDGET
+#
+# Check that a freshly linked ld-nacl-*.so.1 is still what the kernel can
+# map cheaply on every launch: no undefined symbols, no dynamic
+# relocations or text relocations (nothing would process them), at most
+# two PT_LOADs (text and rodata in one, data and bss in the other), and no
+# more than BUDGET bytes of the file mapped.  Prints what's wrong and
+# exits 1 if anything is.
+#
+# READELF in the environment names the readelf to use (default readelf).
+
+READELF=${READELF:-readelf}
+
+if [ $# -ne 2 ]; then
+  echo >&2 "Usage: $0 INTERP BUDGET"
+  exit 2
+fi
+interp=$1
+budget=$2
+status=0
+
+undefined=$($READELF -W --dyn-syms "$interp" |
+            awk '$7 == "UND" && $8 != "" { print $8 }')
+if [ -n "$undefined" ]; then
+  echo >&2 "$interp: undefined symbols:" $undefined
+  status=1
+fi
+
+if $READELF -W -r "$interp" | grep -q '^Relocation section'; then
+  echo >&2 "$interp: has dynamic relocations:"
+  $READELF -W -r "$interp" >&2
+  status=1
+fi
+
+if $READELF -W -d "$interp" | grep -q 'TEXTREL'; then
+  echo >&2 "$interp: has text relocations"
+  status=1
+fi
+
+# Each PT_LOAD line gives: LOAD OFFSET VADDR PADDR FILESIZ MEMSIZ FLAGS...
+set -- $($READELF -W -l "$interp" | awk '
+  function hex(s,  i, n) {
+    s = tolower(s)
+    sub(/^0x/, "", s)
+    for (i = 1; i <= length(s); ++i)
+      n = n * 16 + index("0123456789abcdef", substr(s, i, 1)) - 1
+    return n
+  }
+  $1 == "LOAD" {
+    ++loads
+    end = hex($2) + hex($5)
+    if (end > extent)
+      extent = end
+  }
+  END { print loads + 0, extent + 0 }')
+loads=$1
+extent=$2
+
+if [ "$loads" -gt 2 ]; then
+  echo >&2 "$interp: $loads PT_LOADs, want at most 2"
+  status=1
+fi
+
+if [ "$extent" -gt "$budget" ]; then
+  echo >&2 "$interp: maps $extent bytes of the file, over the budget of $budget"
+  status=1
+fi
+
+exit $status
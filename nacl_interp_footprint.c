@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2011 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Measure what a built ld-nacl-*.so.1 costs each launch by itself, for
+ * comparing builds of it.
+ *
+ * Usage: nacl_interp_footprint [-n COUNT] [-L LOADER] INTERP...
+ *
+ * Each INTERP is run directly, as nacl_interp_replay does, with
+ * NACL_INTERP_LOADER set to LOADER (default /bin/true), a stand-in that
+ * exits immediately.  For each, this prints:
+ *
+ *      loads           its PT_LOAD count
+ *      image-KB        how much of its file those map
+ *      maps            mappings in the process when it execs the loader
+ *                      (not counting the stack, vdso and the like)
+ *      minflt          page faults it took, from its first instruction
+ *                      to the loader exec
+ *      syscalls        system calls it made in that time, exec included
+ *      p50-us, p90-us  latency of COUNT (default 200) launches, from
+ *                      fork to the loader's exit
+ *
+ * The first line is LOADER alone, run directly, for the baseline.  The
+ * maps, minflt and syscalls columns come from one more launch, under
+ * ptrace, stopped at the loader exec.
+ */
+
+#define _GNU_SOURCE
+
+#include <elf.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <link.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+struct footprint {
+  unsigned int loads;
+  unsigned long image;
+  unsigned int maps;
+  unsigned long minflt;
+  unsigned int syscalls;
+};
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compare_double(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+static double percentile(const double *sorted, size_t n, double pct) {
+  size_t i;
+  if (n == 0)
+    return 0;
+  i = (size_t) (pct / 100.0 * (n - 1) + 0.5);
+  return sorted[i];
+}
+
+/*
+ * Fill in FP's loads and image from FILE's program headers.
+ */
+static int read_segments(const char *file, struct footprint *fp) {
+  ElfW(Ehdr) ehdr;
+  ElfW(Phdr) phdr;
+  unsigned int i;
+  int fd = open(file, O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0) {
+    perror(file);
+    return -1;
+  }
+  if (pread(fd, &ehdr, sizeof(ehdr), 0) != sizeof(ehdr) ||
+      memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0 ||
+      ehdr.e_phentsize != sizeof(phdr)) {
+    fprintf(stderr, "%s: not a native ELF file\n", file);
+    close(fd);
+    return -1;
+  }
+  for (i = 0; i < ehdr.e_phnum; ++i) {
+    if (pread(fd, &phdr, sizeof(phdr), ehdr.e_phoff + i * sizeof(phdr)) !=
+        sizeof(phdr))
+      break;
+    if (phdr.p_type == PT_LOAD) {
+      ++fp->loads;
+      if (phdr.p_offset + phdr.p_filesz > fp->image)
+        fp->image = phdr.p_offset + phdr.p_filesz;
+    }
+  }
+  close(fd);
+  return 0;
+}
+
+static unsigned long read_minflt(pid_t pid) {
+  char path[64], buf[1024], *p;
+  unsigned long minflt = 0;
+  FILE *f;
+
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+  f = fopen(path, "r");
+  if (f == NULL)
+    return 0;
+  /*
+   * The command name may have spaces in it; minflt is the eighth field
+   * after it.
+   */
+  if (fgets(buf, sizeof(buf), f) != NULL && (p = strrchr(buf, ')')) != NULL)
+    sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %lu", &minflt);
+  fclose(f);
+  return minflt;
+}
+
+static unsigned int count_maps(pid_t pid) {
+  char path[64], line[4096];
+  unsigned int n = 0;
+  FILE *f;
+
+  snprintf(path, sizeof(path), "/proc/%d/maps", (int) pid);
+  f = fopen(path, "r");
+  if (f == NULL)
+    return 0;
+  while (fgets(line, sizeof(line), f) != NULL)
+    if (strstr(line, " [") == NULL)
+      ++n;
+  fclose(f);
+  return n;
+}
+
+static void exec_alone(const char *interp, char **envp) {
+  char *argv[] = { (char *) interp, NULL };
+  execve(interp, argv, envp);
+  _exit(127);
+}
+
+/*
+ * Run INTERP once under ptrace, from just after its own exec until it
+ * tries to exec the loader, and fill in the rest of FP.
+ */
+static int trace_launch(const char *interp, char **envp,
+                        struct footprint *fp) {
+  unsigned long start_minflt = 0;
+  int status, execs = 0, sig = 0;
+  pid_t pid = fork();
+
+  if (pid < 0) {
+    perror("fork");
+    exit(1);
+  }
+  if (pid == 0) {
+    if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) < 0)
+      _exit(127);
+    raise(SIGSTOP);
+    exec_alone(interp, envp);
+  }
+
+  if (waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status))
+    return -1;
+  ptrace(PTRACE_SETOPTIONS, pid, NULL,
+         PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL);
+
+  for (;;) {
+    if (ptrace(PTRACE_SYSCALL, pid, NULL, sig) < 0 ||
+        waitpid(pid, &status, 0) < 0)
+      return -1;
+    sig = 0;
+    if (!WIFSTOPPED(status))
+      break;
+
+    if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_EXEC << 8))) {
+      start_minflt = read_minflt(pid);
+      execs = 1;
+    } else if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+      struct __ptrace_syscall_info info;
+      if (execs == 0 ||
+          ptrace(PTRACE_GET_SYSCALL_INFO, pid, sizeof(info), &info) <= 0 ||
+          info.op != PTRACE_SYSCALL_INFO_ENTRY)
+        continue;
+      ++fp->syscalls;
+      if (info.entry.nr == SYS_execve) {
+        fp->minflt = read_minflt(pid) - start_minflt;
+        fp->maps = count_maps(pid);
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+        return 0;
+      }
+    } else {
+      sig = WSTOPSIG(status);   /* Pass on real signals.  */
+    }
+  }
+
+  fprintf(stderr, "%s exited without running the loader\n", interp);
+  return -1;
+}
+
+static double timed_launch(const char *program, char **envp) {
+  double start = now();
+  int status;
+  pid_t pid = fork();
+
+  if (pid < 0) {
+    perror("fork");
+    exit(1);
+  }
+  if (pid == 0)
+    exec_alone(program, envp);
+  if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "%s failed with status %#x\n", program, status);
+    exit(1);
+  }
+  return now() - start;
+}
+
+static void print_times(const char *program, char **envp, double *times,
+                        unsigned long count) {
+  unsigned long i;
+  for (i = 0; i < count; ++i)
+    times[i] = timed_launch(program, envp);
+  qsort(times, count, sizeof(times[0]), compare_double);
+  printf(" %9.1f %9.1f  %s\n", percentile(times, count, 50) * 1e6,
+         percentile(times, count, 90) * 1e6, program);
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s [-n COUNT] [-L LOADER] INTERP...\n", argv0);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  const char *loader = "/bin/true";
+  unsigned long count = 200;
+  char *envp[2];
+  double *times;
+  int opt, i;
+
+  while ((opt = getopt(argc, argv, "n:L:")) != -1) {
+    switch (opt) {
+      case 'n':
+        count = strtoul(optarg, NULL, 0);
+        break;
+      case 'L':
+        loader = optarg;
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  if (optind == argc || count == 0)
+    usage(argv[0]);
+
+  if (asprintf(&envp[0], "NACL_INTERP_LOADER=%s", loader) < 0 ||
+      (times = calloc(count, sizeof(times[0]))) == NULL) {
+    perror("main");
+    return 1;
+  }
+  envp[1] = NULL;
+
+  printf("%5s %8s %5s %7s %9s %9s %9s  %s\n", "loads", "image-KB", "maps",
+         "minflt", "syscalls", "p50-us", "p90-us", "program");
+  printf("%5s %8s %5s %7s %9s", "-", "-", "-", "-", "-");
+  print_times(loader, envp, times, count);
+
+  for (i = optind; i < argc; ++i) {
+    struct footprint fp;
+    memset(&fp, 0, sizeof(fp));
+    if (read_segments(argv[i], &fp) < 0 ||
+        trace_launch(argv[i], envp, &fp) < 0)
+      return 1;
+    printf("%5u %8.1f %5u %7lu %9u", fp.loads, fp.image / 1024.0, fp.maps,
+           fp.minflt, fp.syscalls);
+    print_times(argv[i], envp, times, count);
+  }
+
+  return 0;
+}
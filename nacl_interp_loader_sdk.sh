@@ -4,6 +4,18 @@
 # found in the LICENSE file.
 #
 # Usage: nacl_interp_loader.sh PLATFORM NEXE ARGS...
+#        nacl_interp_loader.sh --print-command PLATFORM
+#
+# The second form prints the command that would run a nexe, one word per
+# line and without the nexe and its arguments, so that batch runners such
+# as nacl_interp_run can resolve it once and exec sel_ldr themselves, and
+# so that nacl-preflight can find everything a launch will use.
+
+print_command=
+if [ "$1" = --print-command ]; then
+  print_command=yes
+  shift
+fi
 
 # Assumes this file is sitting in the source tree.
 # This should be changed for some proper SDK installation setup.
@@ -36,6 +48,45 @@ IRT="$NACL_SDK_ROOT/tools/irt_core_${arch}.nexe"
 RTLD="$NACL_TOOLCHAIN_ROOT/x86_64-nacl/${libdir}/runnable-ld.so"
 LIBDIR="$NACL_TOOLCHAIN_ROOT/x86_64-nacl/${libdir}"
 
+# ld-nacl-*.so.1 passes the nexe's minimal library path, as computed by
+# nacl-ldconfig, when NACL_INTERP_LDCACHE has an up-to-date record for it.
+if [ -n "$NACL_INTERP_LIBRARY_PATH" ]; then
+  LIBDIR="$NACL_INTERP_LIBRARY_PATH"
+fi
+unset NACL_INTERP_LIBRARY_PATH
+
+# The validation cache (see nacl_vcache.h) does nothing for a stock
+# sel_ldr, which never reads NACL_VALIDATION_CACHE_SOCKET.  So it's only
+# used when NACL_INTERP_VCACHE_SEL_LDR names a sel_ldr built to use it
+# (or nacl_vcache_standin), which is then run in place of the SDK's, and
+# NACL_INTERP_VCACHE names a store directory.  The loader makes sure
+# nacl-vcached is serving the store, by starting it every time: it does
+# nothing if another one already serves the store (a socket alone may be
+# left from one that died), and exits by itself once idle.  sel_ldr is
+# told where the socket is.
+vcache_socket=
+if [ -n "$NACL_INTERP_VCACHE" ] && [ -n "$NACL_INTERP_VCACHE_SEL_LDR" ]; then
+  SEL_LDR="$NACL_INTERP_VCACHE_SEL_LDR"
+  ${NACL_VCACHED:-nacl-vcached} "$NACL_INTERP_VCACHE" >&2
+  vcache_socket="$NACL_INTERP_VCACHE/socket"
+fi
+
+if [ -n "$print_command" ]; then
+  # Whoever asked runs sel_ldr in its own environment, so the socket is
+  # passed in the command.
+  if [ -n "$vcache_socket" ]; then
+    printf '%s\n' /usr/bin/env "NACL_VALIDATION_CACHE_SOCKET=$vcache_socket"
+  fi
+  printf '%s\n' "$SEL_LDR" -a -S -B "$IRT" -- \
+    "$RTLD" --library-path $LIBDIR
+  exit 0
+fi
+
+if [ -n "$vcache_socket" ]; then
+  NACL_VALIDATION_CACHE_SOCKET="$vcache_socket"
+  export NACL_VALIDATION_CACHE_SOCKET
+fi
+
 echo "$SEL_LDR" -a -S -B "$IRT" -- \
   "$RTLD" --library-path $LIBDIR "$@"
 exec "$SEL_LDR" -a -S -B "$IRT" -- \
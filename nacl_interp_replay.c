@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2011 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Replay a launch trace recorded via NACL_INTERP_TRACE (see nacl_interp.c)
+ * against a built ld-nacl-*.so.1, for capacity planning and for checking
+ * interp changes against a real launch distribution.
+ *
+ * Usage: nacl_interp_replay [-j JOBS] [-s SPEED] [-n COUNT] [-L LOADER] [-v]
+ *                           INTERP TRACEFILE
+ *
+ * Each record is re-issued by running INTERP directly with an argument
+ * vector and environment of the recorded shape (count and total bytes),
+ * and with NACL_INTERP_LOADER set to LOADER (default /bin/true), a
+ * stand-in that exits immediately.  Up to JOBS launches run at once.
+ * SPEED scales the recorded inter-arrival times: 1 replays in real time,
+ * 10 ten times as fast, and 0 (the default) issues launches as fast as
+ * the concurrency limit allows.  A latency summary goes to stdout.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+struct record {
+  double time;
+  char platform[32];
+  unsigned long argc;
+  unsigned long argv_bytes;
+  unsigned long envc;
+  unsigned long env_bytes;
+  char *nexe;
+};
+
+struct slot {
+  pid_t pid;
+  double start;
+};
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void sleep_until(double when) {
+  double delta = when - now();
+  if (delta > 0) {
+    struct timespec ts;
+    ts.tv_sec = (time_t) delta;
+    ts.tv_nsec = (long) ((delta - ts.tv_sec) * 1e9);
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+      continue;
+  }
+}
+
+static struct record *read_trace(const char *file, size_t *count) {
+  FILE *f = fopen(file, "r");
+  struct record *records = NULL;
+  size_t n = 0, alloc = 0;
+  char *line = NULL;
+  size_t linesz = 0;
+  ssize_t len;
+
+  if (f == NULL) {
+    perror(file);
+    exit(1);
+  }
+
+  while ((len = getline(&line, &linesz, f)) > 0) {
+    struct record r;
+    int used = 0;
+    if (line[len - 1] == '\n')
+      line[--len] = '\0';
+    if (sscanf(line, "%lf\t%31[^\t]\t%lu\t%lu\t%lu\t%lu\t%n",
+               &r.time, r.platform, &r.argc, &r.argv_bytes,
+               &r.envc, &r.env_bytes, &used) < 6 || used == 0) {
+      fprintf(stderr, "%s: ignoring malformed record: %s\n", file, line);
+      continue;
+    }
+    r.nexe = strdup(line + used);
+    if (n == alloc) {
+      alloc = alloc == 0 ? 1024 : alloc * 2;
+      records = realloc(records, alloc * sizeof(records[0]));
+      if (records == NULL) {
+        perror("realloc");
+        exit(1);
+      }
+    }
+    records[n++] = r;
+  }
+
+  free(line);
+  fclose(f);
+  *count = n;
+  return records;
+}
+
+/*
+ * Make a NULL-terminated vector of COUNT strings whose sizes (including
+ * NULs) total roughly BYTES.  The first string is FIRST if that's not
+ * NULL; the rest are made from PAD_FORMAT and filled out with 'x'.
+ */
+static char **make_vector(unsigned long count, unsigned long bytes,
+                          const char *first, const char *pad_format) {
+  char **vec = calloc(count + 1, sizeof(vec[0]));
+  unsigned long i = 0;
+
+  if (vec == NULL) {
+    perror("calloc");
+    exit(1);
+  }
+
+  if (count > 0 && first != NULL) {
+    size_t size = strlen(first) + 1;
+    vec[i++] = strdup(first);
+    bytes = bytes > size ? bytes - size : 0;
+  }
+
+  for (; i < count; ++i) {
+    unsigned long share = bytes / (count - i);
+    char head[32];
+    size_t n = snprintf(head, sizeof(head), pad_format, i);
+    size_t len = share > n + 1 ? share - 1 : n;
+    char *s = malloc(len + 1);
+    if (s == NULL) {
+      perror("malloc");
+      exit(1);
+    }
+    memcpy(s, head, n);
+    memset(s + n, 'x', len - n);
+    s[len] = '\0';
+    vec[i] = s;
+    bytes = bytes > len + 1 ? bytes - (len + 1) : 0;
+  }
+
+  return vec;
+}
+
+static void free_vector(char **vec) {
+  char **p;
+  for (p = vec; *p != NULL; ++p)
+    free(*p);
+  free(vec);
+}
+
+static int compare_double(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+static double percentile(const double *sorted, size_t n, double pct) {
+  size_t i;
+  if (n == 0)
+    return 0;
+  i = (size_t) (pct / 100.0 * (n - 1) + 0.5);
+  return sorted[i];
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [-j JOBS] [-s SPEED] [-n COUNT] [-L LOADER] [-v] "
+          "INTERP TRACEFILE\n", argv0);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  const char *loader = "/bin/true";
+  const char *interp;
+  char *loader_env;
+  struct record *records;
+  struct slot *slots;
+  double *latencies;
+  size_t nrecords, limit = 0, i, done = 0;
+  unsigned long jobs = 1, active = 0, failures = 0;
+  long minflt = 0, majflt = 0;
+  double speed = 0, start, trace_start;
+  int verbose = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "j:s:n:L:v")) != -1) {
+    switch (opt) {
+      case 'j':
+        jobs = strtoul(optarg, NULL, 0);
+        if (jobs == 0)
+          jobs = 1;
+        break;
+      case 's':
+        speed = strtod(optarg, NULL);
+        break;
+      case 'n':
+        limit = strtoul(optarg, NULL, 0);
+        break;
+      case 'L':
+        loader = optarg;
+        break;
+      case 'v':
+        verbose = 1;
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  if (argc - optind != 2)
+    usage(argv[0]);
+  interp = argv[optind];
+
+  records = read_trace(argv[optind + 1], &nrecords);
+  if (limit != 0 && limit < nrecords)
+    nrecords = limit;
+  if (nrecords == 0) {
+    fprintf(stderr, "%s: no launch records\n", argv[optind + 1]);
+    return 1;
+  }
+
+  if (asprintf(&loader_env, "NACL_INTERP_LOADER=%s", loader) < 0) {
+    perror("asprintf");
+    return 1;
+  }
+
+  slots = calloc(jobs, sizeof(slots[0]));
+  latencies = calloc(nrecords, sizeof(latencies[0]));
+  if (slots == NULL || latencies == NULL) {
+    perror("calloc");
+    return 1;
+  }
+
+  trace_start = records[0].time;
+  start = now();
+  i = 0;
+  while (done < nrecords) {
+    if (i < nrecords && active < jobs) {
+      const struct record *r = &records[i];
+      char **new_argv, **new_envp;
+      unsigned long j;
+      pid_t pid;
+
+      if (speed > 0)
+        sleep_until(start + (r->time - trace_start) / speed);
+
+      new_argv = make_vector(r->argc, r->argv_bytes, r->nexe, "arg%lu");
+      new_envp = make_vector(r->envc > 0 ? r->envc : 1, r->env_bytes,
+                             loader_env, "NACL_REPLAY_PAD%lu=");
+
+      for (j = 0; j < jobs && slots[j].pid != 0; ++j)
+        continue;
+      slots[j].start = now();
+      pid = fork();
+      if (pid == 0) {
+        execve(interp, new_argv, new_envp);
+        _exit(127);
+      }
+      if (pid < 0) {
+        perror("fork");
+        return 1;
+      }
+      slots[j].pid = pid;
+      ++active;
+      ++i;
+
+      free_vector(new_argv);
+      free_vector(new_envp);
+    } else {
+      struct rusage ru;
+      int status;
+      pid_t pid = wait4(-1, &status, 0, &ru);
+      double end = now();
+      unsigned long j;
+      if (pid < 0) {
+        perror("wait4");
+        return 1;
+      }
+      for (j = 0; j < jobs && slots[j].pid != pid; ++j)
+        continue;
+      if (j == jobs)
+        continue;
+      latencies[done] = end - slots[j].start;
+      if (verbose)
+        printf("%zu\t%d\t%.3f\n", done, status, latencies[done] * 1e3);
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        ++failures;
+      minflt += ru.ru_minflt;
+      majflt += ru.ru_majflt;
+      slots[j].pid = 0;
+      --active;
+      ++done;
+    }
+  }
+
+  {
+    double wall = now() - start;
+    qsort(latencies, done, sizeof(latencies[0]), compare_double);
+    printf("launches      %zu (%lu failed)\n", done, failures);
+    printf("concurrency   %lu\n", jobs);
+    printf("wall          %.3f s\n", wall);
+    printf("rate          %.1f launches/s\n", done / wall);
+    printf("latency p50   %.3f ms\n", percentile(latencies, done, 50) * 1e3);
+    printf("latency p90   %.3f ms\n", percentile(latencies, done, 90) * 1e3);
+    printf("latency p99   %.3f ms\n", percentile(latencies, done, 99) * 1e3);
+    printf("latency max   %.3f ms\n", latencies[done - 1] * 1e3);
+    printf("minflt/launch %.1f\n", (double) minflt / done);
+    printf("majflt/launch %.1f\n", (double) majflt / done);
+  }
+
+  return failures != 0;
+}
@@ -0,0 +1,391 @@
+/*
+ * Copyright (c) 2011 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Run a batch of nexes across all cores, paying the loader's setup once.
+ *
+ * Usage: nacl_interp_run [-j JOBS] [-L LOADER] [-p PLATFORM] [-l LOGDIR]
+ *                        [-v] MANIFEST
+ *
+ * MANIFEST has one job per line: a nexe followed by its arguments,
+ * separated by white space (there is no quoting).  Blank lines and lines
+ * starting with # are ignored; "-" reads the manifest from stdin.
+ *
+ * Rather than execing each nexe and going through ld-nacl-*.so.1 and the
+ * loader script every time, the command the loader would run is resolved
+ * once, with "LOADER --print-command PLATFORM", and each job then spawns
+ * sel_ldr directly (see nacl_spawn.h).  LOADER defaults to
+ * $NACL_INTERP_LOADER and PLATFORM to the interp's default for this
+ * machine.  A nexe with an up-to-date NACL_INTERP_LDCACHE or
+ * NACL_INTERP_XATTR record still goes through the loader, so that the
+ * record applies; nacl_spawn.h lists the ways this differs from execing
+ * the nexe.
+ *
+ * JOBS (default: the number of online CPUs) worker threads each start
+ * with an equal slice of the manifest and take jobs from its front; a
+ * worker whose slice runs out steals the back half of another's.  With
+ * -l, each job's stdout and stderr go to LOGDIR/INDEX.log instead of
+ * being inherited.  -v prints a line per job as it finishes.  A summary
+ * goes to stdout, and the exit status is 1 if any job failed.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nacl_spawn.h"
+
+struct job {
+  char **argv;                  /* The nexe and its arguments.  */
+  int status;                   /* From wait4, or -1 if the spawn failed.  */
+  double seconds;
+  long minflt;
+};
+
+/*
+ * A worker owns jobs [next, end).  It takes from the front; thieves take
+ * from the back.  Nobody ever holds two workers' locks at once.
+ */
+struct worker {
+  pthread_mutex_t lock;
+  size_t next;
+  size_t end;
+  size_t index;
+  unsigned long steals;
+  pthread_t thread;
+};
+
+static struct nacl_spawn_config config;
+static struct job *jobs;
+static size_t njobs;
+static struct worker *workers;
+static size_t nworkers;
+static const char *logdir;
+static int verbose;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *xrealloc(void *ptr, size_t size) {
+  ptr = realloc(ptr, size);
+  if (ptr == NULL) {
+    perror("realloc");
+    exit(1);
+  }
+  return ptr;
+}
+
+/*
+ * Split S in place at white space into a NULL-terminated vector.
+ */
+static char **split_words(char *s, size_t *count) {
+  char **words = NULL;
+  size_t n = 0;
+  char *word;
+
+  for (word = strtok(s, " \t\n"); word != NULL;
+       word = strtok(NULL, " \t\n")) {
+    words = xrealloc(words, (n + 2) * sizeof(words[0]));
+    words[n++] = word;
+  }
+  if (words != NULL)
+    words[n] = NULL;
+  *count = n;
+  return words;
+}
+
+static void read_manifest(const char *file) {
+  FILE *f = strcmp(file, "-") == 0 ? stdin : fopen(file, "r");
+  size_t alloc = 0;
+  char *line = NULL;
+  size_t linesz = 0;
+
+  if (f == NULL) {
+    perror(file);
+    exit(1);
+  }
+
+  while (getline(&line, &linesz, f) > 0) {
+    char *copy, **words;
+    size_t nwords;
+    struct job *job;
+
+    if (line[strspn(line, " \t\n")] == '\0' || line[0] == '#')
+      continue;
+    copy = strdup(line);
+    words = split_words(copy, &nwords);
+
+    if (njobs == alloc) {
+      alloc = alloc == 0 ? 1024 : alloc * 2;
+      jobs = xrealloc(jobs, alloc * sizeof(jobs[0]));
+    }
+    job = &jobs[njobs++];
+    job->argv = words;
+    job->status = -1;
+  }
+
+  free(line);
+  if (f != stdin)
+    fclose(f);
+}
+
+static void run_job(size_t index) {
+  struct job *job = &jobs[index];
+  posix_spawn_file_actions_t actions;
+  struct rusage ru;
+  double start;
+  pid_t pid;
+  int error;
+
+  posix_spawn_file_actions_init(&actions);
+  if (logdir != NULL) {
+    char *log;
+    if (asprintf(&log, "%s/%zu.log", logdir, index) < 0) {
+      perror("asprintf");
+      exit(1);
+    }
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, log,
+                                     O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+    free(log);
+  }
+
+  start = now();
+  error = nacl_spawn(&pid, &config, job->argv[0], &actions, NULL,
+                     job->argv, NULL);
+  posix_spawn_file_actions_destroy(&actions);
+  if (error != 0) {
+    fprintf(stderr, "%s: %s\n", job->argv[0], strerror(error));
+    return;
+  }
+  while (wait4(pid, &job->status, 0, &ru) < 0)
+    if (errno != EINTR) {
+      perror("wait4");
+      exit(1);
+    }
+  job->seconds = now() - start;
+  job->minflt = ru.ru_minflt;
+
+  if (verbose)
+    printf("%zu\t%d\t%.3f\t%s\n", index, job->status, job->seconds * 1e3,
+           job->argv[0]);
+}
+
+/*
+ * Take the back half of some other worker's remaining jobs, trying them
+ * in turn starting after SELF.  Returns false when there are none left.
+ */
+static int steal(struct worker *self) {
+  size_t i;
+
+  for (i = 1; i < nworkers; ++i) {
+    struct worker *victim = &workers[(self->index + i) % nworkers];
+    size_t first = 0, last = 0;
+
+    pthread_mutex_lock(&victim->lock);
+    if (victim->next < victim->end) {
+      size_t half = (victim->end - victim->next + 1) / 2;
+      last = victim->end;
+      first = victim->end = last - half;
+    }
+    pthread_mutex_unlock(&victim->lock);
+
+    if (first < last) {
+      pthread_mutex_lock(&self->lock);
+      self->next = first;
+      self->end = last;
+      pthread_mutex_unlock(&self->lock);
+      ++self->steals;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void *work(void *arg) {
+  struct worker *self = arg;
+
+  for (;;) {
+    size_t index = 0;
+    int have = 0;
+
+    pthread_mutex_lock(&self->lock);
+    if (self->next < self->end) {
+      index = self->next++;
+      have = 1;
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    if (have)
+      run_job(index);
+    else if (!steal(self))
+      return NULL;
+  }
+}
+
+static int compare_double(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+static double percentile(const double *sorted, size_t n, double pct) {
+  size_t i;
+  if (n == 0)
+    return 0;
+  i = (size_t) (pct / 100.0 * (n - 1) + 0.5);
+  return sorted[i];
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [-j JOBS] [-L LOADER] [-p PLATFORM] [-l LOGDIR] [-v] "
+          "MANIFEST\n", argv0);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  const char *loader = getenv("NACL_INTERP_LOADER");
+  const char *platform = NULL;
+  size_t i, done = 0;
+  unsigned long failed = 0, signaled = 0, unspawned = 0, steals = 0;
+  long minflt = 0;
+  double *times, total = 0, start, wall;
+  int error, opt;
+
+  nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+  while ((opt = getopt(argc, argv, "j:L:p:l:v")) != -1) {
+    switch (opt) {
+      case 'j':
+        nworkers = strtoul(optarg, NULL, 0);
+        break;
+      case 'L':
+        loader = optarg;
+        break;
+      case 'p':
+        platform = optarg;
+        break;
+      case 'l':
+        logdir = optarg;
+        break;
+      case 'v':
+        verbose = 1;
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  if (argc - optind != 1)
+    usage(argv[0]);
+  if (loader == NULL) {
+    fprintf(stderr, "%s: no -L and NACL_INTERP_LOADER is not set\n", argv[0]);
+    return 2;
+  }
+
+  error = nacl_spawn_config_init(&config, loader, platform,
+                                 NACL_SPAWN_DIRECT);
+  if (error != 0) {
+    fprintf(stderr, "%s --print-command: %s\n", loader, strerror(error));
+    return 1;
+  }
+  read_manifest(argv[optind]);
+  if (njobs == 0) {
+    fprintf(stderr, "%s: no jobs\n", argv[optind]);
+    return 1;
+  }
+  if (nworkers == 0)
+    nworkers = 1;
+  if (nworkers > njobs)
+    nworkers = njobs;
+
+  workers = calloc(nworkers, sizeof(workers[0]));
+  if (workers == NULL) {
+    perror("calloc");
+    return 1;
+  }
+  for (i = 0; i < nworkers; ++i) {
+    pthread_mutex_init(&workers[i].lock, NULL);
+    workers[i].index = i;
+    workers[i].next = njobs * i / nworkers;
+    workers[i].end = njobs * (i + 1) / nworkers;
+  }
+
+  start = now();
+  for (i = 0; i < nworkers; ++i) {
+    errno = pthread_create(&workers[i].thread, NULL, work, &workers[i]);
+    if (errno != 0) {
+      perror("pthread_create");
+      return 1;
+    }
+  }
+  for (i = 0; i < nworkers; ++i) {
+    pthread_join(workers[i].thread, NULL);
+    steals += workers[i].steals;
+  }
+  wall = now() - start;
+
+  times = calloc(njobs, sizeof(times[0]));
+  if (times == NULL) {
+    perror("calloc");
+    return 1;
+  }
+  for (i = 0; i < njobs; ++i) {
+    const struct job *job = &jobs[i];
+    if (job->status == -1) {
+      ++unspawned;
+    } else {
+      if (WIFSIGNALED(job->status))
+        ++signaled;
+      else if (WEXITSTATUS(job->status) != 0)
+        ++failed;
+      times[done++] = job->seconds;
+      total += job->seconds;
+      minflt += job->minflt;
+    }
+  }
+  qsort(times, done, sizeof(times[0]), compare_double);
+
+  for (i = 0; i < njobs; ++i) {
+    const struct job *job = &jobs[i];
+    if (job->status == -1)
+      printf("FAIL %zu %s: not started\n", i, job->argv[0]);
+    else if (WIFSIGNALED(job->status))
+      printf("FAIL %zu %s: signal %d\n", i, job->argv[0],
+             WTERMSIG(job->status));
+    else if (WEXITSTATUS(job->status) != 0)
+      printf("FAIL %zu %s: exit %d\n", i, job->argv[0],
+             WEXITSTATUS(job->status));
+  }
+
+  printf("jobs          %zu (%lu failed, %lu signaled, %lu not started)\n",
+         njobs, failed, signaled, unspawned);
+  printf("workers       %zu (%lu steals)\n", nworkers, steals);
+  printf("wall          %.3f s\n", wall);
+  printf("rate          %.1f jobs/s\n", njobs / wall);
+  printf("job time      %.3f s total\n", total);
+  printf("job p50       %.3f ms\n", percentile(times, done, 50) * 1e3);
+  printf("job p90       %.3f ms\n", percentile(times, done, 90) * 1e3);
+  printf("job p99       %.3f ms\n", percentile(times, done, 99) * 1e3);
+  printf("job max       %.3f ms\n",
+         done != 0 ? times[done - 1] * 1e3 : 0.0);
+  printf("minflt/job    %.1f\n", done != 0 ? (double) minflt / done : 0.0);
+
+  return failed + signaled + unspawned != 0;
+}
@@ -0,0 +1,492 @@
+/*
+ * Copyright (c) 2011 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * The pure parts of nacl_interp's startup: picking apart the initial
+ * stack image the kernel hands us and building the loader's argument
+ * vector.  Nothing here makes system calls or touches global state, so
+ * the same code is compiled into the freestanding interp and into host
+ * programs (nacl_interp_bench) that feed it synthetic stack images.
+ *
+ * Everything is static inline, so each program gets only what it uses,
+ * and calls need no relocations: the interp must not have any.
+ */
+
+#ifndef NACL_INTERP_START_H
+#define NACL_INTERP_START_H
+
+#include <elf.h>
+#include <link.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * String scanning a word at a time.  A load never reaches into a page
+ * beyond the one holding a string's terminating NUL, so these can't fault
+ * even at the very end of a mapping.  MIN_PAGE_SIZE need only be no
+ * bigger than the real page size.
+ */
+typedef uintptr_t __attribute__((may_alias)) nacl_word;
+typedef uintptr_t __attribute__((may_alias, aligned(1))) nacl_unaligned_word;
+
+#define MIN_PAGE_SIZE 4096
+#define WORD_SIZE sizeof(uintptr_t)
+#define WORD_ONES ((uintptr_t) -1 / 0xff)
+#define WORD_HIGHS (WORD_ONES << 7)
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+# define WORD_TOWARD_START(w, bits) ((w) >> (bits))
+# define WORD_TOWARD_END(w, bits) ((w) << (bits))
+#else
+# define WORD_TOWARD_START(w, bits) ((w) << (bits))
+# define WORD_TOWARD_END(w, bits) ((w) >> (bits))
+#endif
+
+static inline uintptr_t word_has_zero_byte(uintptr_t w) {
+  return (w - WORD_ONES) & ~w & WORD_HIGHS;
+}
+
+/*
+ * Load the WORD_SIZE bytes at S, in memory order, from a possibly
+ * unaligned string.  If the string ends before that, the bytes after its
+ * NUL are unspecified.  When the word might straddle a page boundary,
+ * only the aligned words it overlaps are loaded, and the second of those
+ * only if the string reaches it.
+ */
+static inline uintptr_t load_string_word(const char *s) {
+  uintptr_t offset = (uintptr_t) s & (WORD_SIZE - 1);
+  const nacl_word *p = (const nacl_word *) (s - offset);
+  uintptr_t w;
+
+  if (((uintptr_t) s & (MIN_PAGE_SIZE - 1)) <= MIN_PAGE_SIZE - WORD_SIZE)
+    return *(const nacl_unaligned_word *) s;
+
+  if (offset == 0)
+    return p[0];
+
+  w = WORD_TOWARD_START(p[0], offset * 8);
+  if (!word_has_zero_byte(w | WORD_TOWARD_END((uintptr_t) -1,
+                                              (WORD_SIZE - offset) * 8)))
+    w |= WORD_TOWARD_END(p[1], (WORD_SIZE - offset) * 8);
+  return w;
+}
+
+static inline size_t my_strlen(const char *s) {
+  const char *p = s;
+  const nacl_word *w;
+
+  for (; ((uintptr_t) p & (WORD_SIZE - 1)) != 0; ++p)
+    if (*p == '\0')
+      return p - s;
+
+  for (w = (const nacl_word *) p; !word_has_zero_byte(*w); ++w)
+    continue;
+
+  for (p = (const char *) w; *p != '\0'; ++p)
+    continue;
+  return p - s;
+}
+
+static inline const char *environ_match(const char *name,
+                                        const char *envstring) {
+  const char *a = name;
+  const char *b = envstring;
+  while (*a == *b) {
+    if (*a == '\0')
+      return NULL;
+    ++a;
+    ++b;
+  }
+  if (*a == '\0' && *b == '=')
+    return b + 1;
+  return NULL;
+}
+
+/*
+ * The environment variables the interp understands, all of which start
+ * with NACL_INTERP_ENV_PREFIX.  Each is NULL if not set.  To add one, add
+ * a field here, clear it in clear_env, and add a case in scan_variable.
+ */
+#define NACL_INTERP_ENV_PREFIX "NACL_INTERP_"
+
+struct nacl_interp_env {
+  const char *loader;           /* NACL_INTERP_LOADER */
+  const char *trace;            /* NACL_INTERP_TRACE */
+  const char *ldcache;          /* NACL_INTERP_LDCACHE */
+  const char *xattr;            /* NACL_INTERP_XATTR */
+  const char *supervisor;       /* NACL_INTERP_SUPERVISOR */
+  const char *prefetch;         /* NACL_INTERP_PREFETCH */
+  const char *argfile;          /* NACL_INTERP_ARGFILE */
+};
+
+/*
+ * The prefix as whole words, in memory order.
+ */
+#define PREFIX_LENGTH (sizeof(NACL_INTERP_ENV_PREFIX) - 1)
+#define PREFIX_WORDS ((PREFIX_LENGTH + WORD_SIZE - 1) / WORD_SIZE)
+static const union {
+  char bytes[PREFIX_WORDS * WORD_SIZE];
+  uintptr_t words[PREFIX_WORDS];
+} env_prefix = { NACL_INTERP_ENV_PREFIX };
+
+static inline void clear_env(struct nacl_interp_env *env) {
+  env->loader = NULL;
+  env->trace = NULL;
+  env->ldcache = NULL;
+  env->xattr = NULL;
+  env->supervisor = NULL;
+  env->prefetch = NULL;
+  env->argfile = NULL;
+}
+
+static inline void set_once(const char **field, const char *value) {
+  if (*field == NULL)
+    *field = value;
+}
+
+/*
+ * Check one environment string against the variables we know.  Nearly
+ * every string is rejected by the first word comparison.
+ */
+static inline void scan_variable(const char *envstring,
+                                 struct nacl_interp_env *env) {
+  const char *rest = envstring + PREFIX_LENGTH;
+  const char *value;
+  size_t i;
+
+  for (i = 0; i < PREFIX_WORDS; ++i) {
+    size_t tail = (i + 1) * WORD_SIZE - PREFIX_LENGTH;
+    uintptr_t mask = (uintptr_t) -1;
+    if (i == PREFIX_WORDS - 1 && tail != 0)
+      mask = WORD_TOWARD_START(mask, tail * 8);
+    if (((load_string_word(envstring + i * WORD_SIZE) ^ env_prefix.words[i])
+         & mask) != 0)
+      return;
+  }
+
+  switch (rest[0]) {
+    case 'A':
+      if ((value = environ_match("ARGFILE", rest)) != NULL)
+        set_once(&env->argfile, value);
+      break;
+    case 'L':
+      if ((value = environ_match("LOADER", rest)) != NULL)
+        set_once(&env->loader, value);
+      else if ((value = environ_match("LDCACHE", rest)) != NULL)
+        set_once(&env->ldcache, value);
+      break;
+    case 'P':
+      if ((value = environ_match("PREFETCH", rest)) != NULL)
+        set_once(&env->prefetch, value);
+      break;
+    case 'S':
+      if ((value = environ_match("SUPERVISOR", rest)) != NULL)
+        set_once(&env->supervisor, value);
+      break;
+    case 'T':
+      if ((value = environ_match("TRACE", rest)) != NULL)
+        set_once(&env->trace, value);
+      break;
+    case 'X':
+      if ((value = environ_match("XATTR", rest)) != NULL)
+        set_once(&env->xattr, value);
+      break;
+  }
+}
+
+/*
+ * What do_start learns from the initial stack.  PHDR and PHNUM describe
+ * the nexe's program headers, which the kernel has mapped for us.  EXECFN
+ * and PLATFORM are NULL if the auxiliary vector didn't supply them;
+ * SECURE errs on the side of caution when AT_SECURE is missing.  ENV
+ * holds whatever of our own environment variables are set.
+ */
+struct nacl_startup {
+  int argc;
+  const char *const *argv;
+  const char *const *envp;
+  int envc;
+  const ElfW(auxv_t) *auxv;
+  const ElfW(Phdr) *phdr;
+  size_t phnum;
+  const char *execfn;
+  const char *platform;
+  bool secure;
+  struct nacl_interp_env env;
+};
+
+/*
+ * Pick out the auxiliary vector entries we care about.
+ */
+static inline void parse_auxv(const ElfW(auxv_t) *auxv,
+                              struct nacl_startup *info) {
+  const ElfW(auxv_t) *av;
+
+  info->auxv = auxv;
+  info->phdr = NULL;
+  info->phnum = 0;
+  info->execfn = NULL;
+  info->platform = NULL;
+  info->secure = true;
+
+  for (av = auxv; av->a_type != AT_NULL; ++av)
+    switch (av->a_type) {
+      case AT_PHDR:
+        info->phdr = (const ElfW(Phdr) *) av->a_un.a_val;
+        break;
+      case AT_PHNUM:
+        info->phnum = av->a_un.a_val;
+        break;
+      case AT_EXECFN:
+        info->execfn = (const char *) av->a_un.a_val;
+        break;
+      case AT_PLATFORM:
+        info->platform = (const char *) av->a_un.a_val;
+        break;
+      case AT_SECURE:
+        info->secure = av->a_un.a_val != 0;
+        break;
+    }
+}
+
+/*
+ * STACK is the initial stack pointer as the kernel set it up:
+ * argc, argv[0..argc-1], NULL, envp..., NULL, auxv pairs..., AT_NULL.
+ * The only walk that can't be avoided is over envp to find the auxv,
+ * so that same pass picks out our environment variables.
+ */
+static inline void parse_stack(const uintptr_t *stack,
+                               struct nacl_startup *info) {
+  const char *const *ep;
+
+  info->argc = stack[0];
+  info->argv = (const char *const *) &stack[1];
+  info->envp = &info->argv[info->argc + 1];
+
+  clear_env(&info->env);
+  for (ep = info->envp; *ep != NULL; ++ep)
+    scan_variable(*ep, &info->env);
+  info->envc = ep - info->envp;
+
+  parse_auxv((const ElfW(auxv_t) *) (ep + 1), info);
+}
+
+/*
+ * The PLATFORM to pass when AT_PLATFORM is missing.
+ */
+static inline const char *default_platform(void) {
+#if defined(__x86_64__)
+  return "x86_64";
+#elif defined(__i386__)
+  return "i386";
+#elif defined(__arm__)
+  return "arm";
+#elif defined(__mips__)
+  return "mips";
+#else
+# error "Don't know default platform!"
+#endif
+}
+
+/*
+ * Number of slots build_loader_argv needs, with room to spare.
+ */
+static inline size_t loader_argv_size(int argc) {
+  return argc + 4;
+}
+
+/*
+ * Fill NEW_ARGV (of NPREFIX + ARGC + 1 slots) with:
+ *      PREFIX... EXECFN ARGV[1]... NULL
+ * EXECFN stands in for the nexe's own argv[0].
+ */
+static inline void build_command_argv(const char **new_argv,
+                                      const char *const *prefix,
+                                      size_t nprefix, const char *execfn,
+                                      int argc, const char *const *argv) {
+  size_t i;
+  int j;
+
+  for (i = 0; i < nprefix; ++i)
+    new_argv[i] = prefix[i];
+  new_argv[nprefix] = execfn;
+  for (j = 1; j <= argc; ++j)
+    new_argv[nprefix + j] = argv[j];
+}
+
+/*
+ * Fill NEW_ARGV (of loader_argv_size(ARGC) slots) with:
+ *      LOADER PLATFORM EXECFN ARGV[1]... NULL
+ */
+static inline void build_loader_argv(const char **new_argv,
+                                     const char *loader,
+                                     const char *platform,
+                                     const char *execfn, int argc,
+                                     const char *const *argv) {
+  const char *prefix[2];
+
+  prefix[0] = loader;
+  prefix[1] = platform;
+  build_command_argv(new_argv, prefix, 2, execfn, argc, argv);
+}
+
+/*
+ * With NACL_INTERP_ARGFILE, a long argument list is passed down the chain
+ * as a single argument, NACL_ARGV_REF_PREFIX and a descriptor number,
+ * naming a sealed memfd called NACL_ARGV_MEMFD_NAME that holds the
+ * arguments themselves, each NUL-terminated.  See nacl_expand_argv in
+ * nacl_spawn.h for the receiving end.  The interp only does this for a
+ * loader whose file has the extended attribute NACL_ARGV_XATTR_NAME (with
+ * any value), e.g. "setfattr -n user.nacl.argfile -v 1 LOADER", set by
+ * whoever knows that the loader's chain ends in nacl_expand_argv.
+ */
+#define NACL_ARGV_MEMFD_NAME "nacl-argv"
+#define NACL_ARGV_REF_PREFIX "@/proc/self/fd/"
+#define NACL_ARGV_XATTR_NAME "user.nacl.argfile"
+
+/*
+ * Per-nexe metadata records, as written by nacl-ldconfig either to a
+ * file or to the nexe's NACL_XATTR_NAME extended attribute.  A record is
+ * lines of text.  The first is "stamp " and the nexe's identity stamp
+ * from format_stamp; the record is stale once that no longer matches.
+ * Each line of the form NACL_INTERP_*=VALUE is put in the loader's
+ * environment.  Other lines are only for the tools.
+ *
+ * NACL_STAMP_SIZE covers five 64-bit hex numbers, separators and a NUL.
+ */
+#define NACL_XATTR_NAME "user.nacl.meta"
+#define NACL_RECORD_STAMP "stamp "
+#define NACL_STAMP_SIZE (5 * 17)
+#define NACL_MAX_EXPORTS 8
+
+static inline char *format_hex(char *p, uint64_t value) {
+  int shift = 60;
+  while (shift > 0 && (value >> shift) == 0)
+    shift -= 4;
+  for (; shift >= 0; shift -= 4)
+    *p++ = "0123456789abcdef"[(value >> shift) & 0xf];
+  return p;
+}
+
+/*
+ * The identity used to key the metadata: DEV-INO.
+ */
+static inline size_t format_identity(char *buf, uint64_t dev,
+                                     uint64_t ino) {
+  char *p = format_hex(buf, dev);
+  *p++ = '-';
+  p = format_hex(p, ino);
+  *p = '\0';
+  return p - buf;
+}
+
+/*
+ * The identity plus what changes when the file is rewritten:
+ * DEV:INO:MTIME.NSEC:SIZE.
+ */
+static inline size_t format_stamp(char *buf, uint64_t dev, uint64_t ino,
+                                  uint64_t mtime, uint64_t mtime_nsec,
+                                  uint64_t size) {
+  char *p = format_hex(buf, dev);
+  *p++ = ':';
+  p = format_hex(p, ino);
+  *p++ = ':';
+  p = format_hex(p, mtime);
+  *p++ = '.';
+  p = format_hex(p, mtime_nsec);
+  *p++ = ':';
+  p = format_hex(p, size);
+  *p = '\0';
+  return p - buf;
+}
+
+/*
+ * Check RECORD (LEN bytes, not NUL-terminated) against STAMP and collect
+ * up to NACL_MAX_EXPORTS environment settings from it into EXPORTS.  The
+ * lines are NUL-terminated in place.  Returns the number of settings, or
+ * -1 if the record is malformed or stale.
+ */
+static inline int parse_record(char *record, size_t len,
+                               const char *stamp, const char **exports) {
+  char *end = record + len;
+  char *line = record;
+  int nexports = 0;
+  bool first = true;
+
+  while (line < end) {
+    char *eol = line;
+    while (eol < end && *eol != '\n')
+      ++eol;
+    if (eol == end)
+      break;                    /* Ignore a partial last line.  */
+    *eol = '\0';
+
+    if (first) {
+      const char *a = NACL_RECORD_STAMP;
+      const char *b = line;
+      while (*a != '\0' && *a == *b) {
+        ++a;
+        ++b;
+      }
+      if (*a != '\0')
+        return -1;
+      for (a = stamp; *a != '\0' && *a == *b; ++a)
+        ++b;
+      if (*a != '\0' || *b != '\0')
+        return -1;
+      first = false;
+    } else if (nexports < NACL_MAX_EXPORTS &&
+               eol - line > (ptrdiff_t) PREFIX_LENGTH) {
+      size_t i;
+      for (i = 0; i < PREFIX_LENGTH; ++i)
+        if (line[i] != NACL_INTERP_ENV_PREFIX[i])
+          break;
+      if (i == PREFIX_LENGTH)
+        exports[nexports++] = line;
+    }
+
+    line = eol + 1;
+  }
+
+  return first ? -1 : nexports;
+}
+
+/*
+ * Does the NAME=VALUE string A set the same variable as B?
+ */
+static inline bool same_variable(const char *a, const char *b) {
+  while (*a == *b && *a != '=' && *a != '\0') {
+    ++a;
+    ++b;
+  }
+  return *a == '=' && *b == '=';
+}
+
+/*
+ * Fill NEW_ENVP (of ENVC + NEXPORTS + 1 slots) with ENVP, less anything
+ * EXPORTS overrides, followed by EXPORTS.
+ */
+static inline void build_loader_envp(const char **new_envp,
+                                     const char *const *envp,
+                                     const char *const *exports,
+                                     int nexports) {
+  const char *const *ep;
+  int i;
+
+  for (ep = envp; *ep != NULL; ++ep) {
+    for (i = 0; i < nexports; ++i)
+      if (same_variable(*ep, exports[i]))
+        break;
+    if (i == nexports)
+      *new_envp++ = *ep;
+  }
+  for (i = 0; i < nexports; ++i)
+    *new_envp++ = exports[i];
+  *new_envp = NULL;
+}
+
+#endif  /* NACL_INTERP_START_H */
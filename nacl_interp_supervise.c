@@ -0,0 +1,1656 @@
+/*
+ * Copyright (c) 2011 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * A supervisor for nexe launches, run by ld-nacl-*.so.1 in place of the
+ * loader when NACL_INTERP_SUPERVISOR names it (see nacl_interp.c).
+ *
+ * Usage: nacl_interp_supervise LOADER PLATFORM NEXE ARGS...
+ *
+ * If NACL_INTERP_CGROUP names a cgroup v2 directory, the loader is
+ * started directly inside a new child cgroup of it, NEXE-BASENAME.PID,
+ * using clone3 with CLONE_INTO_CGROUP, so that every process of the
+ * launch is accounted there.  When the loader exits, the cgroup's CPU,
+ * peak memory and I/O totals are reported, the cgroup is removed, and the
+ * supervisor exits as the loader did.  The parent cgroup must be
+ * delegated to the user, with the cpu, memory and io controllers enabled
+ * in its cgroup.subtree_control for the full set of numbers and limits.
+ * If the child cgroup can't be made or entered, the supervisor says so
+ * and runs the loader without one, and nothing is reported.
+ *
+ * The report is one line of tab-separated fields:
+ *      TIME NEXE STATUS WALL-US CPU-US USER-US SYSTEM-US MEMORY-PEAK
+ *      READ-BYTES WRITE-BYTES READ-IOS WRITE-IOS
+ * STATUS is the wait status in hex, and any number the kernel doesn't
+ * provide is "-".  It is appended to the file NACL_INTERP_CGROUP_REPORT
+ * if that's set, and written to stderr otherwise.
+ *
+ * A profile can be named by NACL_INTERP_PROFILE (which nacl-ldconfig -p
+ * arranges per nexe) and is read from the file of that name in the
+ * directory NACL_INTERP_PROFILE_DIR.  Each line is a KEY and a VALUE,
+ * separated by white space; # starts a comment line.  These keys are
+ * understood, and others are ignored:
+ *      cgroup DIR      Use DIR rather than NACL_INTERP_CGROUP.
+ *      CONTROL VALUE   Write VALUE to the launch cgroup's CONTROL file,
+ *                      for CONTROL among cpu.*, memory.*, io.* and pids.*;
+ *                      e.g. "memory.high 512M" or "cpu.max 50000 100000".
+ *      memoize DIR     Memoize launches in the store DIR; see below.
+ *      memoize-env NAME
+ *                      The environment variable NAME is part of the key.
+ *      memoize-input FILE
+ *                      FILE's contents are part of the key.
+ *      memoize-output FILE
+ *                      FILE is recorded and replayed.
+ * The last three may be given any number of times.  For the last two,
+ * FILE may instead be @N, for the nexe's Nth argument, or @OPTION, for
+ * the argument after each OPTION (or, for a two-character OPTION like
+ * -o, joined to it).
+ *
+ * Memoization is for deterministic tools, such as code generators, that
+ * are run over and over on the same inputs.  The key is a text that
+ * lists the loader, the platform, a hash of the nexe's contents, every
+ * argument, each memoize-env variable, each memoize-input file's hash and
+ * each memoize-output file; the launch is looked up by its SHA-256.  On a
+ * hit, the output files, the standard output and error (in that order,
+ * not interleaved) and the exit status recorded for it are replayed, and
+ * the loader isn't run at all.  On a miss, the loader is run with its
+ * standard input from /dev/null and its standard output and error passed
+ * through, and if it exits rather than being killed, all of that is
+ * recorded.  Nothing outside the key is checked: a tool that reads
+ * other files, its standard input, the time or its working directory
+ * must not be memoized.  Launches whose arguments were passed in a
+ * NACL_INTERP_ARGFILE memfd aren't memoized.
+ *
+ * The store is plain files:
+ *      DIR/objects/HASH        contents recorded, by their SHA-256
+ *      DIR/results/KEY         what to replay for KEY
+ *      DIR/results/KEY.key     the key text that hashes to KEY
+ *      DIR/ids/DEV-INO         a file's stamp and hash, to skip rehashing
+ * so it can be inspected with cat and cleared with rm.  Run as
+ *      nacl_interp_supervise --explain LOADER PLATFORM NEXE ARGS...
+ * (in the same environment) it prints a launch's key text, its key and
+ * whether it would hit, without running anything.  If NACL_INTERP_MEMO_LOG
+ * is set, a line "TIME EVENT KEY NEXE" is appended to that file for each
+ * memoized launch, where EVENT is hit, miss, record or skip.
+ *
+ * The slow-launch sampler is an always-on way to catch rare slow starts
+ * as they happen.  It's on when NACL_INTERP_SLOW_LAUNCH_MS, or the
+ * profile's "slow-launch MS", sets a budget for startup.  Startup ends
+ * when NEXE (or its mirror copy) shows up in /proc/PID/maps for some
+ * process of the launch, i.e. once sel_ldr has loaded it, or when the
+ * loader exits.  Nothing is asked of the launch itself.  One that gets
+ * there within budget costs only a poll and, when the budget runs out,
+ * a look at its maps.  One that doesn't has each of its processes
+ * sampled every
+ * NACL_INTERP_SLOW_INTERVAL_MS ("slow-launch-interval MS"; default 10)
+ * until it does, or for at most 64 samples, and a report is appended to
+ * NACL_INTERP_SLOW_REPORT if that's set, or written to stderr otherwise:
+ *      slow-launch TIME host=HOST platform=PLATFORM nexe=NEXE
+ *        budget-ms=B startup-ms=S end=ready|exit|unfinished samples=N
+ *        +MS PID COMM STATE wchan=W run-us=R wait-us=W slices=N
+ *            rchar=N read-bytes=N maps=N stack=F<F<F<F
+ *        mapped PID: FILE...
+ * (the first is one line; each sample is one line per process, from
+ * /proc/PID/{stat,wchan,schedstat,io,maps,stack}, and each process's
+ * mapped files are listed at its first sample).
+ *
+ * If NACL_INTERP_MIRROR names a local directory (tmpfs or SSD), nexes
+ * that live on other filesystems, such as NFS, are copied into it, and
+ * the loader is given the copy; see mirror_nexe, below.
+ *
+ * If NACL_INTERP_HOTD names the socket of a nacl-hotd, each launch that
+ * runs the loader is reported to it, by sending it an open descriptor
+ * for NEXE, so that it can keep the most launched nexes in memory.
+ * Nothing waits for the daemon.
+ *
+ * With no cgroup configured, no memoization and no sampler, the loader
+ * is simply exec'd.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/sched.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nacl_interp_start.h"
+#include "nacl_sha256.h"
+
+#ifndef CLONE_INTO_CGROUP
+# define CLONE_INTO_CGROUP 0x200000000ULL
+#endif
+
+struct setting {
+  char *key;
+  char *value;
+};
+
+struct profile {
+  struct setting *settings;
+  size_t nsettings;
+};
+
+static const char *progname = "nacl_interp_supervise";
+static volatile pid_t child_pid;
+
+static void die(const char *what) {
+  fprintf(stderr, "%s: %s: %s\n", progname, what, strerror(errno));
+  exit(127);
+}
+
+static double now(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void read_profile(struct profile *profile) {
+  const char *dir = getenv("NACL_INTERP_PROFILE_DIR");
+  const char *name = getenv("NACL_INTERP_PROFILE");
+  char *file, *line = NULL;
+  size_t linesz = 0;
+  ssize_t len;
+  FILE *f;
+
+  profile->settings = NULL;
+  profile->nsettings = 0;
+  if (dir == NULL || name == NULL || name[0] == '\0' ||
+      strchr(name, '/') != NULL)
+    return;
+
+  if (asprintf(&file, "%s/%s", dir, name) < 0)
+    die("asprintf");
+  f = fopen(file, "r");
+  if (f == NULL) {
+    fprintf(stderr, "%s: %s: %s\n", progname, file, strerror(errno));
+    free(file);
+    return;
+  }
+
+  while ((len = getline(&line, &linesz, f)) > 0) {
+    char *key = line + strspn(line, " \t");
+    char *value;
+    struct setting *bigger;
+
+    if (line[len - 1] == '\n')
+      line[--len] = '\0';
+    if (*key == '\0' || *key == '#')
+      continue;
+    value = key + strcspn(key, " \t");
+    if (*value != '\0')
+      *value++ = '\0';
+    value += strspn(value, " \t");
+
+    bigger = realloc(profile->settings,
+                     (profile->nsettings + 1) * sizeof(*bigger));
+    if (bigger == NULL)
+      die("realloc");
+    profile->settings = bigger;
+    bigger[profile->nsettings].key = strdup(key);
+    bigger[profile->nsettings].value = strdup(value);
+    ++profile->nsettings;
+  }
+
+  free(line);
+  fclose(f);
+  free(file);
+}
+
+static const char *profile_get(const struct profile *profile,
+                               const char *key) {
+  size_t i;
+  for (i = 0; i < profile->nsettings; ++i)
+    if (!strcmp(profile->settings[i].key, key))
+      return profile->settings[i].value;
+  return NULL;
+}
+
+static int is_limit(const char *key) {
+  static const char *const controllers[] = { "cpu.", "memory.", "io.",
+                                             "pids." };
+  size_t i;
+  if (strchr(key, '/') != NULL)
+    return 0;
+  for (i = 0; i < sizeof(controllers) / sizeof(controllers[0]); ++i)
+    if (!strncmp(key, controllers[i], strlen(controllers[i])))
+      return 1;
+  return 0;
+}
+
+static int write_file(const char *dir, const char *file, const char *value) {
+  char *path;
+  int fd, ok;
+
+  if (asprintf(&path, "%s/%s", dir, file) < 0)
+    die("asprintf");
+  fd = open(path, O_WRONLY | O_CLOEXEC);
+  free(path);
+  if (fd < 0)
+    return -1;
+  ok = write(fd, value, strlen(value)) == (ssize_t) strlen(value);
+  close(fd);
+  return ok ? 0 : -1;
+}
+
+/*
+ * Read a cgroup file into a static buffer, or return NULL.
+ */
+static const char *read_file(const char *dir, const char *file) {
+  static char buf[8192];
+  char *path;
+  ssize_t n;
+  int fd;
+
+  if (asprintf(&path, "%s/%s", dir, file) < 0)
+    die("asprintf");
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  free(path);
+  if (fd < 0)
+    return NULL;
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n < 0)
+    return NULL;
+  buf[n] = '\0';
+  return buf;
+}
+
+/*
+ * Make the launch's cgroup and apply the profile's limits to it.  If it
+ * can't be made, say so and return NULL: the launch goes ahead without.
+ */
+static char *make_cgroup(const char *parent, const char *nexe,
+                         const struct profile *profile) {
+  const char *base = strrchr(nexe, '/');
+  char *dir;
+  size_t i;
+
+  base = base == NULL ? nexe : base + 1;
+  if (asprintf(&dir, "%s/%s.%ld", parent, base, (long) getpid()) < 0)
+    die("asprintf");
+  if (mkdir(dir, 0755) < 0) {
+    fprintf(stderr, "%s: %s: %s; running without a cgroup\n",
+            progname, dir, strerror(errno));
+    free(dir);
+    return NULL;
+  }
+
+  for (i = 0; i < profile->nsettings; ++i) {
+    const struct setting *s = &profile->settings[i];
+    if (is_limit(s->key) && write_file(dir, s->key, s->value) < 0)
+      fprintf(stderr, "%s: cannot set %s/%s to %s: %s\n",
+              progname, dir, s->key, s->value, strerror(errno));
+  }
+
+  return dir;
+}
+
+/*
+ * In the child: take STDIO, if not NULL, as file descriptors 0 to 2, and
+ * exec ARGV.
+ */
+static void exec_loader(char **argv, const int *stdio) {
+  int i;
+  if (stdio != NULL)
+    for (i = 0; i < 3; ++i)
+      if (dup2(stdio[i], i) < 0)
+        _exit(127);
+  execv(argv[0], argv);
+  _exit(127);
+}
+
+/*
+ * Start ARGV in cgroup DIR.  clone3 puts the child there atomically, so
+ * not even its first page faults are charged elsewhere; on kernels
+ * without it, the child moves itself before exec'ing.  Returns -1 if the
+ * child couldn't be put there at all (e.g. pids.max is already reached),
+ * and then the caller starts it without the cgroup.
+ */
+static pid_t start_in_cgroup(const char *dir, char **argv,
+                             const int *stdio) {
+  struct clone_args args;
+  pid_t pid;
+  int cgroup_fd = open(dir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+  if (cgroup_fd < 0)
+    return -1;
+
+  memset(&args, 0, sizeof(args));
+  args.flags = CLONE_INTO_CGROUP;
+  args.exit_signal = SIGCHLD;
+  args.cgroup = cgroup_fd;
+  pid = syscall(SYS_clone3, &args, sizeof(args));
+  if (pid == 0)
+    exec_loader(argv, stdio);
+  if (pid < 0 && (errno == ENOSYS || errno == E2BIG || errno == EINVAL)) {
+    pid = fork();
+    if (pid == 0) {
+      if (write_file(dir, "cgroup.procs", "0") < 0)
+        fprintf(stderr, "%s: %s: %s; running without a cgroup\n",
+                progname, dir, strerror(errno));
+      exec_loader(argv, stdio);
+    }
+  }
+
+  close(cgroup_fd);
+  return pid;
+}
+
+/*
+ * Start ARGV, in cgroup *DIR if that's not NULL.  If it can't go there,
+ * the cgroup is removed, *DIR is set to NULL, and it starts outside.
+ */
+static pid_t start_loader(char **dir, char **argv, const int *stdio) {
+  pid_t pid;
+  if (*dir != NULL) {
+    pid = start_in_cgroup(*dir, argv, stdio);
+    if (pid > 0)
+      return pid;
+    fprintf(stderr, "%s: cannot start in %s: %s; running without it\n",
+            progname, *dir, strerror(errno));
+    rmdir(*dir);
+    free(*dir);
+    *dir = NULL;
+  }
+  pid = fork();
+  if (pid < 0)
+    die("fork");
+  if (pid == 0)
+    exec_loader(argv, stdio);
+  return pid;
+}
+
+/*
+ * The local mirror (NACL_INTERP_MIRROR).  The first launch of a nexe that
+ * isn't on the mirror's own filesystem copies it into the mirror, under
+ * a name made from a hash of its absolute path, its mtime and its size.
+ * Every launch after that hands the loader the copy, so the original
+ * costs one stat per launch, which is also what notices when it has been
+ * replaced.  A copy is written under a temporary name and renamed into
+ * place, so no launch sees half of one; racing launches just both copy.
+ * Each hit sets the copy's atime, which nacl-mirror uses to evict the
+ * least recently launched when the mirror gets too big.
+ *
+ * Whoever can write the mirror directory can change what the loader runs,
+ * so it should belong to the user running the nexes.  Any trouble
+ * copying leaves the launch using the original.  An unpacked nexe (see
+ * nacl_lz4.h) is already in memory, and is left alone.
+ */
+static void mirror_name(char name[4 * 17], const char *abspath,
+                        const struct stat *st) {
+  uint64_t hash = 0xcbf29ce484222325ULL;        /* FNV-1a */
+  char *p = name;
+
+  for (; *abspath != '\0'; ++abspath)
+    hash = (hash ^ (uint8_t) *abspath) * 0x100000001b3ULL;
+  p = format_hex(p, hash);
+  *p++ = '-';
+  p = format_hex(p, st->st_mtim.tv_sec);
+  *p++ = '.';
+  p = format_hex(p, st->st_mtim.tv_nsec);
+  *p++ = '-';
+  p = format_hex(p, st->st_size);
+  *p = '\0';
+}
+
+/*
+ * Copy SIZE bytes from IN to OUT, in the kernel.  copy_file_range won't
+ * go between some filesystems, and sendfile will.
+ */
+static int copy_contents(int in, int out, size_t size) {
+  int across = 0;
+  size_t done = 0;
+
+  while (done < size) {
+    ssize_t n = across ? sendfile(out, in, NULL, size - done)
+        : copy_file_range(in, NULL, out, NULL, size - done, 0);
+    if (n > 0)
+      done += n;
+    else if (n < 0 && done == 0 && !across)
+      across = 1;
+    else
+      return -1;
+  }
+  return 0;
+}
+
+static const char *mirror_nexe(const char *nexe) {
+  static const struct timespec touch[2] = {
+    { 0, UTIME_NOW }, { 0, UTIME_OMIT }
+  };
+  const char *dir = getenv("NACL_INTERP_MIRROR");
+  char name[4 * 17], *abspath, *mirror, *tmp;
+  struct stat st, dir_st, after;
+  int in, out, ok;
+
+  if (dir == NULL || dir[0] == '\0' ||
+      !strncmp(nexe, "/proc/self/fd/", strlen("/proc/self/fd/")) ||
+      stat(nexe, &st) < 0 || !S_ISREG(st.st_mode) ||
+      stat(dir, &dir_st) < 0 || dir_st.st_dev == st.st_dev ||
+      (abspath = realpath(nexe, NULL)) == NULL)
+    return nexe;
+
+  mirror_name(name, abspath, &st);
+  free(abspath);
+  if (asprintf(&mirror, "%s/%s", dir, name) < 0)
+    die("asprintf");
+  if (utimensat(AT_FDCWD, mirror, touch, 0) == 0 ||
+      errno == EPERM)           /* It's there, but someone else's.  */
+    return mirror;
+
+  /*
+   * Write DIR/.NAME.PID and rename it to DIR/NAME.
+   */
+  if (asprintf(&tmp, "%s/.%s.%x", dir, name, (unsigned int) getpid()) < 0)
+    die("asprintf");
+  in = open(nexe, O_RDONLY | O_CLOEXEC);
+  out = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 0555);
+  ok = in >= 0 && out >= 0 && copy_contents(in, out, st.st_size) == 0 &&
+      fstat(in, &after) == 0 &&
+      after.st_mtim.tv_sec == st.st_mtim.tv_sec &&
+      after.st_mtim.tv_nsec == st.st_mtim.tv_nsec &&
+      after.st_size == st.st_size;
+  if (in >= 0)
+    close(in);
+  if (out >= 0)
+    ok = close(out) == 0 && ok;
+  ok = ok && rename(tmp, mirror) == 0;
+  if (!ok && out >= 0)
+    unlink(tmp);
+  free(tmp);
+  if (!ok) {
+    free(mirror);
+    return nexe;
+  }
+  return mirror;
+}
+
+/*
+ * Report this launch of NEXE to the nacl-hotd at NACL_INTERP_HOTD, if
+ * that's set: a one-byte datagram with a descriptor for the file.  A
+ * daemon that isn't there, or is too busy to take it, just misses it.
+ */
+static void report_launch(const char *nexe) {
+  const char *socket_path = getenv("NACL_INTERP_HOTD");
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct sockaddr_un addr;
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  struct iovec iov;
+  int fd, sock;
+
+  if (socket_path == NULL || socket_path[0] == '\0' ||
+      strlen(socket_path) >= sizeof(addr.sun_path))
+    return;
+  fd = open(nexe, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return;
+  sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (sock >= 0) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    iov.iov_base = (char *) "L";
+    iov.iov_len = 1;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &addr;
+    msg.msg_namelen = sizeof(addr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    sendmsg(sock, &msg, MSG_NOSIGNAL);
+    close(sock);
+  }
+  close(fd);
+}
+
+static void forward_signal(int sig) {
+  if (child_pid > 0)
+    kill(child_pid, sig);
+}
+
+static void forward_signals(pid_t pid) {
+  static const int forwarded[] = { SIGHUP, SIGINT, SIGQUIT, SIGTERM };
+  struct sigaction sa;
+  size_t i;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = forward_signal;
+  sa.sa_flags = SA_RESTART;
+  child_pid = pid;
+  for (i = 0; i < sizeof(forwarded) / sizeof(forwarded[0]); ++i)
+    sigaction(forwarded[i], &sa, NULL);
+}
+
+static int wait_for_child(pid_t pid) {
+  int status;
+
+  while (waitpid(pid, &status, 0) < 0)
+    if (errno != EINTR)
+      die("waitpid");
+  return status;
+}
+
+/*
+ * Find "KEY VALUE" among the lines of TEXT, as in cpu.stat.
+ */
+static const char *stat_field(const char *text, const char *key) {
+  size_t len = strlen(key);
+  const char *line;
+  for (line = text; line != NULL && *line != '\0';
+       line = strchr(line, '\n'), line = line == NULL ? NULL : line + 1)
+    if (!strncmp(line, key, len) && line[len] == ' ')
+      return line + len + 1;
+  return NULL;
+}
+
+static void append_number(char **p, char *end, const char *value) {
+  const char *v = value;
+  size_t n;
+  if (v == NULL)
+    v = "-";
+  n = strcspn(v, " \n");
+  if ((size_t) (end - *p) > n + 1) {
+    *(*p)++ = '\t';
+    memcpy(*p, v, n);
+    *p += n;
+  }
+}
+
+static void report(const char *dir, const char *nexe, int status,
+                   double wall) {
+  static const char *const cpu_keys[] = { "usage_usec", "user_usec",
+                                          "system_usec" };
+  static const char *const io_keys[] = { "rbytes=", "wbytes=", "rios=",
+                                         "wios=" };
+  unsigned long long io[4] = { 0, 0, 0, 0 };
+  char line[8192], number[32];
+  char *p = line, *end = line + sizeof(line) - 1;
+  const char *text, *file;
+  size_t i;
+  int fd;
+
+  p += snprintf(line, sizeof(line), "%.9f\t%s\t%x\t%.0f",
+                now(CLOCK_REALTIME), nexe, status, wall * 1e6);
+  if (p > end)
+    p = end;
+
+  text = read_file(dir, "cpu.stat");
+  for (i = 0; i < sizeof(cpu_keys) / sizeof(cpu_keys[0]); ++i)
+    append_number(&p, end,
+                  text == NULL ? NULL : stat_field(text, cpu_keys[i]));
+
+  append_number(&p, end, read_file(dir, "memory.peak"));
+
+  /*
+   * io.stat has a line per device; the launch's totals are their sums.
+   */
+  text = read_file(dir, "io.stat");
+  for (i = 0; i < sizeof(io_keys) / sizeof(io_keys[0]); ++i) {
+    const char *s;
+    for (s = text; s != NULL && (s = strstr(s, io_keys[i])) != NULL;
+         s += strlen(io_keys[i]))
+      io[i] += strtoull(s + strlen(io_keys[i]), NULL, 10);
+    snprintf(number, sizeof(number), "%llu", io[i]);
+    append_number(&p, end, text == NULL ? NULL : number);
+  }
+  *p++ = '\n';
+
+  file = getenv("NACL_INTERP_CGROUP_REPORT");
+  fd = file == NULL ? STDERR_FILENO :
+      open(file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+  if (fd < 0) {
+    fprintf(stderr, "%s: %s: %s\n", progname, file, strerror(errno));
+    return;
+  }
+  if (write(fd, line, p - line) < 0)
+    fprintf(stderr, "%s: writing report: %s\n", progname, strerror(errno));
+  if (fd != STDERR_FILENO)
+    close(fd);
+}
+
+/*
+ * The slow-launch sampler; see the top of the file.  A launch is watched
+ * from when it starts until it's ready: the nexe is mapped somewhere in
+ * the launch's process tree, or the loader has exited.  Exit is seen by
+ * polling a pidfd for the loader, or, on kernels without pidfd_open, by
+ * checking every interval.  The maps are only read once the budget has
+ * run out, and then after each sample: each process in the launch is
+ * sampled every interval from then until it's ready, or for at most
+ * MAX_SAMPLES samples, and the report is written once it's over.
+ */
+#define MAX_SAMPLES 64
+#define MAX_STACK_FRAMES 4
+
+struct watch {
+  pid_t pid;
+  int watching;
+  int pidfd;                    /* Polled for the loader's exit, or -1.  */
+  dev_t dev;                    /* The nexe the loader is given.  */
+  ino_t ino;
+  double start;
+  double budget;
+  double interval;
+  double next;                  /* When to sample next.  */
+  unsigned int samples;
+  FILE *body;                   /* The samples, once the budget's blown.  */
+  char *text;
+  size_t len;
+};
+
+static double env_ms(const struct profile *profile, const char *key,
+                     const char *variable, double fallback) {
+  const char *value = profile_get(profile, key);
+  if (value == NULL)
+    value = getenv(variable);
+  return value == NULL || value[0] == '\0' ? fallback : atof(value) / 1e3;
+}
+
+/*
+ * Set W up from PROFILE and the environment, to watch for NEXE, the
+ * file the loader will be given.  Returns 0 if launches are to be
+ * watched.
+ */
+static int watch_prepare(struct watch *w, const struct profile *profile,
+                         const char *nexe) {
+  struct stat st;
+
+  w->watching = 0;
+  w->pidfd = -1;
+  w->budget = env_ms(profile, "slow-launch", "NACL_INTERP_SLOW_LAUNCH_MS", 0);
+  w->interval = env_ms(profile, "slow-launch-interval",
+                       "NACL_INTERP_SLOW_INTERVAL_MS", 0.01);
+  if (w->budget <= 0 || w->interval <= 0 || stat(nexe, &st) < 0)
+    return -1;
+  w->dev = st.st_dev;
+  w->ino = st.st_ino;
+  w->samples = 0;
+  w->body = NULL;
+  return 0;
+}
+
+static void watch_start(struct watch *w, pid_t pid) {
+  w->watching = 1;
+  w->pid = pid;
+  w->pidfd = syscall(SYS_pidfd_open, pid, 0);
+  w->start = now(CLOCK_MONOTONIC);
+  w->next = w->start + w->budget;
+}
+
+/*
+ * How long poll should wait for W's pidfd, in milliseconds.  Without
+ * one, exit is checked for every interval.
+ */
+static int watch_timeout(const struct watch *w) {
+  double left = w->next - now(CLOCK_MONOTONIC);
+  if (!w->watching)
+    return -1;
+  if (w->pidfd < 0 && left > w->interval)
+    left = w->interval;
+  return left <= 0 ? 0 : (int) (left * 1e3) + 1;
+}
+
+/*
+ * Has the loader exited?  It isn't reaped here, just looked at.
+ */
+static int watch_exited(const struct watch *w) {
+  siginfo_t info;
+
+  info.si_pid = 0;
+  if (waitid(P_PID, w->pid, &info, WEXITED | WNOHANG | WNOWAIT) < 0)
+    return errno != EINTR;
+  return info.si_pid != 0;
+}
+
+/*
+ * Does process PID have W's nexe mapped?
+ */
+static int maps_nexe(const struct watch *w, pid_t pid) {
+  char path[64], *line = NULL;
+  size_t linesz = 0;
+  int found = 0;
+  FILE *m;
+
+  snprintf(path, sizeof(path), "/proc/%d/maps", (int) pid);
+  m = fopen(path, "re");
+  if (m == NULL)
+    return 0;
+  while (!found && getline(&line, &linesz, m) > 0) {
+    unsigned int maj, min;
+    unsigned long ino;
+    if (sscanf(line, "%*s %*s %*s %x:%x %lu", &maj, &min, &ino) == 3)
+      found = ino == w->ino && makedev(maj, min) == w->dev;
+  }
+  free(line);
+  fclose(m);
+  return found;
+}
+
+/*
+ * Does PID or any of its descendants have W's nexe mapped?
+ */
+static int tree_maps_nexe(const struct watch *w, pid_t pid, int depth) {
+  char dir[64];
+  const char *children;
+  char *copy, *p, *end;
+  int found;
+
+  if (maps_nexe(w, pid))
+    return 1;
+  snprintf(dir, sizeof(dir), "/proc/%d/task/%d", (int) pid, (int) pid);
+  children = read_file(dir, "children");
+  if (children == NULL || depth > 8)
+    return 0;
+  copy = strdup(children);
+  found = 0;
+  for (p = copy; !found && (pid = strtol(p, &end, 10)) > 0; p = end)
+    found = tree_maps_nexe(w, pid, depth + 1);
+  free(copy);
+  return found;
+}
+
+/*
+ * Append the stack's innermost function names, innermost first, like
+ * "do_sys_poll<__x64_sys_poll<do_syscall_64".
+ */
+static void append_stack(FILE *f, const char *text) {
+  const char *line = text;
+  int frames = 0;
+
+  while (line != NULL && *line != '\0' && frames < MAX_STACK_FRAMES) {
+    const char *name = strchr(line, ']');
+    size_t len;
+    if (name == NULL)
+      break;
+    name += 1 + strspn(name + 1, " ");
+    len = strcspn(name, "+\n");
+    fprintf(f, "%s%.*s", frames++ == 0 ? "" : "<", (int) len, name);
+    line = strchr(line, '\n');
+    if (line != NULL)
+      ++line;
+  }
+  if (frames == 0)
+    fputc('-', f);
+}
+
+static unsigned long long io_field(const char *text, const char *key) {
+  const char *value = text == NULL ? NULL : strstr(text, key);
+  return value == NULL ? 0 : strtoull(value + strlen(key), NULL, 10);
+}
+
+/*
+ * Sample process PID into W's body, T milliseconds into the launch.  On
+ * the first sample, also list the files it has mapped.
+ */
+static void sample_process(struct watch *w, pid_t pid, double t) {
+  unsigned long long run = 0, wait = 0, slices = 0;
+  char dir[64], comm[64] = "?", state = '?';
+  const char *text, *p;
+  unsigned int maps = 0;
+  FILE *f = w->body;
+
+  snprintf(dir, sizeof(dir), "/proc/%d", (int) pid);
+  if ((text = read_file(dir, "comm")) != NULL)
+    snprintf(comm, sizeof(comm), "%.*s", (int) strcspn(text, "\n"), text);
+  if ((text = read_file(dir, "stat")) != NULL &&
+      (p = strrchr(text, ')')) != NULL && p[1] == ' ')
+    state = p[2];
+  fprintf(f, "  +%.1f %d %s %c wchan=", t, (int) pid, comm, state);
+  text = read_file(dir, "wchan");
+  fputs(text == NULL || text[0] == '\0' ? "-" : text, f);
+  if ((text = read_file(dir, "schedstat")) != NULL)
+    sscanf(text, "%llu %llu %llu", &run, &wait, &slices);
+  fprintf(f, " run-us=%llu wait-us=%llu slices=%llu", run / 1000,
+          wait / 1000, slices);
+  text = read_file(dir, "io");
+  fprintf(f, " rchar=%llu read-bytes=%llu", io_field(text, "rchar: "),
+          io_field(text, "read_bytes: "));
+  if ((text = read_file(dir, "maps")) != NULL)
+    for (p = text; (p = strchr(p, '\n')) != NULL; ++p)
+      ++maps;
+  fprintf(f, " maps=%u stack=", maps);
+  append_stack(f, read_file(dir, "stack"));
+  fputc('\n', f);
+
+  if (w->samples == 0 && maps > 0) {
+    char *path, *line = NULL, *last = NULL;
+    size_t linesz = 0;
+    FILE *m;
+
+    if (asprintf(&path, "%s/maps", dir) < 0)
+      die("asprintf");
+    m = fopen(path, "re");
+    free(path);
+    if (m == NULL)
+      return;
+    fprintf(f, "  mapped %d:", (int) pid);
+    while (getline(&line, &linesz, m) > 0) {
+      char *file = strchr(line, '/');
+      if (file == NULL)
+        continue;
+      file[strcspn(file, "\n")] = '\0';
+      if (last != NULL && !strcmp(last, file))
+        continue;
+      fprintf(f, " %s", file);
+      free(last);
+      last = strdup(file);
+    }
+    fputc('\n', f);
+    free(last);
+    free(line);
+    fclose(m);
+  }
+}
+
+/*
+ * Sample PID and all its descendants.
+ */
+static void sample_tree(struct watch *w, pid_t pid, double t, int depth) {
+  char dir[64];
+  const char *children;
+  char *copy, *p, *end;
+
+  sample_process(w, pid, t);
+  snprintf(dir, sizeof(dir), "/proc/%d/task/%d", (int) pid, (int) pid);
+  children = read_file(dir, "children");
+  if (children == NULL || depth > 8)
+    return;
+  copy = strdup(children);
+  for (p = copy; (pid = strtol(p, &end, 10)) > 0; p = end)
+    sample_tree(w, pid, t, depth + 1);
+  free(copy);
+}
+
+static void watch_report(struct watch *w, const char *end,
+                         const char *platform, const char *nexe) {
+  struct utsname un;
+  const char *file;
+  char *header;
+  int fd, n;
+
+  fclose(w->body);
+  if (uname(&un) < 0)
+    snprintf(un.nodename, sizeof(un.nodename), "-");
+  n = asprintf(&header, "slow-launch %.6f host=%s platform=%s nexe=%s "
+               "budget-ms=%.1f startup-ms=%.1f end=%s samples=%u\n",
+               now(CLOCK_REALTIME), un.nodename, platform, nexe,
+               w->budget * 1e3, (now(CLOCK_MONOTONIC) - w->start) * 1e3,
+               end, w->samples);
+  if (n < 0)
+    die("asprintf");
+  header = realloc(header, n + w->len);
+  if (header == NULL)
+    die("realloc");
+  memcpy(header + n, w->text, w->len);
+  free(w->text);
+
+  /*
+   * One write, so reports from concurrent launches don't interleave.
+   */
+  file = getenv("NACL_INTERP_SLOW_REPORT");
+  fd = file == NULL ? STDERR_FILENO :
+      open(file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+  if (fd < 0)
+    fprintf(stderr, "%s: %s: %s\n", progname, file, strerror(errno));
+  else if (write(fd, header, n + w->len) < 0)
+    fprintf(stderr, "%s: writing report: %s\n", progname, strerror(errno));
+  if (fd >= 0 && fd != STDERR_FILENO)
+    close(fd);
+  free(header);
+}
+
+/*
+ * Stop watching, with END saying why.
+ */
+static void watch_finish(struct watch *w, const char *end,
+                         const char *platform, const char *nexe) {
+  if (w->pidfd >= 0)
+    close(w->pidfd);
+  w->pidfd = -1;
+  w->watching = 0;
+  if (w->body != NULL)
+    watch_report(w, end, platform, nexe);
+}
+
+/*
+ * Handle what poll found on W's pidfd (REVENTS) or, if nothing, a
+ * timeout.
+ */
+static void watch_update(struct watch *w, short revents,
+                         const char *platform, const char *nexe) {
+  double t = now(CLOCK_MONOTONIC);
+
+  if (!w->watching)
+    return;
+  if (revents != 0 || (w->pidfd < 0 && watch_exited(w))) {
+    watch_finish(w, "exit", platform, nexe);
+    return;
+  }
+  if (t < w->next)
+    return;
+  if (tree_maps_nexe(w, w->pid, 0)) {
+    watch_finish(w, "ready", platform, nexe);
+    return;
+  }
+
+  if (w->body == NULL) {
+    w->body = open_memstream(&w->text, &w->len);
+    if (w->body == NULL)
+      die("open_memstream");
+  }
+  sample_tree(w, w->pid, (t - w->start) * 1e3, 0);
+  ++w->samples;
+  w->next = t + w->interval;
+  if (w->samples == MAX_SAMPLES)
+    watch_finish(w, "unfinished", platform, nexe);
+}
+
+/*
+ * Watch until the launch is ready, for launches not memoized (which
+ * watch_update from pass_through).
+ */
+static void watch_launch(struct watch *w, const char *platform,
+                         const char *nexe) {
+  while (w->watching) {
+    struct pollfd fd = { w->pidfd, POLLIN, 0 };
+    int n = poll(&fd, 1, watch_timeout(w));
+    if (n < 0 && errno != EINTR)
+      die("poll");
+    if (n >= 0)
+      watch_update(w, n > 0 ? fd.revents : 0, platform, nexe);
+  }
+}
+
+/*
+ * Memoization; see the top of the file.
+ */
+#define MEMO_VERSION "nacl-memo 1"
+
+struct memo {
+  const char *store;
+  char *text;                   /* The key text.  */
+  size_t text_len;
+  char key[NACL_SHA256_HEX_SIZE];
+  char **outputs;
+  size_t noutputs;
+};
+
+static char *store_path(const struct memo *memo, const char *sub,
+                        const char *name) {
+  char *path;
+  if (asprintf(&path, "%s/%s/%s", memo->store, sub, name) < 0)
+    die("asprintf");
+  return path;
+}
+
+static void memo_log(const struct memo *memo, const char *event,
+                     const char *nexe) {
+  const char *file = getenv("NACL_INTERP_MEMO_LOG");
+  FILE *f;
+
+  if (file == NULL || file[0] == '\0')
+    return;
+  f = fopen(file, "ae");
+  if (f == NULL)
+    return;
+  fprintf(f, "%.9f\t%s\t%s\t%s\n", now(CLOCK_REALTIME), event,
+          memo->key[0] == '\0' ? "-" : memo->key, nexe);
+  fclose(f);
+}
+
+/*
+ * Find the SHA-256 of the file at PATH, from DIR/ids if the file hasn't
+ * changed since it was last hashed.  Returns -1 with errno set if PATH
+ * can't be read or isn't a regular file.
+ */
+static int hash_file(const struct memo *memo, const char *path,
+                     char hex[NACL_SHA256_HEX_SIZE]) {
+  char stamp[128], record[256], name[64];
+  struct stat before, after;
+  char *idpath, *tmp;
+  ssize_t n;
+  int fd, idfd;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  if (fstat(fd, &before) < 0 || !S_ISREG(before.st_mode)) {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+  snprintf(stamp, sizeof(stamp), "%llx:%llx:%llx.%lx:%llx.%lx:%llx",
+           (unsigned long long) before.st_dev,
+           (unsigned long long) before.st_ino,
+           (unsigned long long) before.st_mtim.tv_sec, before.st_mtim.tv_nsec,
+           (unsigned long long) before.st_ctim.tv_sec, before.st_ctim.tv_nsec,
+           (unsigned long long) before.st_size);
+  snprintf(name, sizeof(name), "%llx-%llx",
+           (unsigned long long) before.st_dev,
+           (unsigned long long) before.st_ino);
+  idpath = store_path(memo, "ids", name);
+
+  idfd = open(idpath, O_RDONLY | O_CLOEXEC);
+  if (idfd >= 0) {
+    size_t len = strlen(stamp);
+    n = read(idfd, record, sizeof(record) - 1);
+    close(idfd);
+    if (n == (ssize_t) (len + NACL_SHA256_HEX_SIZE) &&
+        !memcmp(record, stamp, len) && record[len] == ' ') {
+      memcpy(hex, record + len + 1, NACL_SHA256_HEX_SIZE - 1);
+      hex[NACL_SHA256_HEX_SIZE - 1] = '\0';
+      close(fd);
+      free(idpath);
+      return 0;
+    }
+  }
+
+  if (nacl_sha256_fd(fd, hex) < 0 || fstat(fd, &after) < 0) {
+    close(fd);
+    free(idpath);
+    return -1;
+  }
+  close(fd);
+  if (after.st_ctim.tv_sec != before.st_ctim.tv_sec ||
+      after.st_ctim.tv_nsec != before.st_ctim.tv_nsec) {
+    free(idpath);
+    errno = EAGAIN;             /* It changed while we were reading it.  */
+    return -1;
+  }
+
+  if (asprintf(&tmp, "%s.%d", idpath, (int) getpid()) < 0)
+    die("asprintf");
+  idfd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (idfd >= 0) {
+    n = snprintf(record, sizeof(record), "%s %s", stamp, hex);
+    if (write(idfd, record, n) == n && close(idfd) == 0)
+      rename(tmp, idpath);
+    else
+      unlink(tmp);
+  }
+  free(tmp);
+  free(idpath);
+  return 0;
+}
+
+/*
+ * Write S to F with backslashes and newlines escaped, so each key item
+ * stays on one line.
+ */
+static void put_escaped(FILE *f, const char *s) {
+  for (; *s != '\0'; ++s) {
+    if (*s == '\\')
+      fputs("\\\\", f);
+    else if (*s == '\n')
+      fputs("\\n", f);
+    else
+      fputc(*s, f);
+  }
+}
+
+/*
+ * Add to *FILES each file that SPEC names, given the nexe's arguments
+ * ARGS (ARGS[0] being its argv[0]).
+ */
+static void add_files(char ***files, size_t *nfiles, const char *spec,
+                      char **args, int nargs) {
+  const char *found[64];
+  size_t n = 0, i;
+
+  if (spec[0] != '@') {
+    found[n++] = spec;
+  } else if (spec[1] >= '0' && spec[1] <= '9') {
+    int index = atoi(spec + 1);
+    if (index < nargs)
+      found[n++] = args[index];
+  } else {
+    const char *option = spec + 1;
+    size_t len = strlen(option);
+    int j;
+    for (j = 1; j < nargs && n < sizeof(found) / sizeof(found[0]); ++j) {
+      if (!strcmp(args[j], option) && j + 1 < nargs)
+        found[n++] = args[++j];
+      else if (len == 2 && option[0] == '-' &&
+               !strncmp(args[j], option, 2) && args[j][2] != '\0')
+        found[n++] = args[j] + 2;
+    }
+  }
+
+  for (i = 0; i < n; ++i) {
+    *files = realloc(*files, (*nfiles + 1) * sizeof(**files));
+    if (*files == NULL)
+      die("realloc");
+    (*files)[(*nfiles)++] = (char *) found[i];
+  }
+}
+
+/*
+ * Work out the key for launching ARGV (LOADER PLATFORM NEXE ARGS...) with
+ * PROFILE.  Returns 0, or -1 if this launch can't be memoized.
+ */
+static int build_key(struct memo *memo, const struct profile *profile,
+                     int argc, char **argv) {
+  char hex[NACL_SHA256_HEX_SIZE];
+  struct nacl_sha256 ctx;
+  char **inputs = NULL;
+  size_t ninputs = 0, i;
+  int ok = 0;
+  FILE *f;
+
+  memo->key[0] = '\0';
+  memo->outputs = NULL;
+  memo->noutputs = 0;
+  for (i = 4; i < (size_t) argc; ++i)
+    if (!strncmp(argv[i], NACL_ARGV_REF_PREFIX,
+                 strlen(NACL_ARGV_REF_PREFIX)))
+      return -1;
+  for (i = 0; i < profile->nsettings; ++i) {
+    const struct setting *s = &profile->settings[i];
+    if (!strcmp(s->key, "memoize-input"))
+      add_files(&inputs, &ninputs, s->value, &argv[3], argc - 3);
+    else if (!strcmp(s->key, "memoize-output"))
+      add_files(&memo->outputs, &memo->noutputs, s->value,
+                &argv[3], argc - 3);
+  }
+  for (i = 0; i < memo->noutputs; ++i)
+    if (strchr(memo->outputs[i], '\n') != NULL)
+      return -1;
+
+  f = open_memstream(&memo->text, &memo->text_len);
+  if (f == NULL)
+    die("open_memstream");
+  fputs(MEMO_VERSION "\nloader ", f);
+  put_escaped(f, argv[1]);
+  fputs("\nplatform ", f);
+  put_escaped(f, argv[2]);
+  if (hash_file(memo, argv[3], hex) < 0)
+    ok = -1;
+  else
+    fprintf(f, "\nnexe %s", hex);
+  for (i = 4; i < (size_t) argc; ++i) {
+    fputs("\narg ", f);
+    put_escaped(f, argv[i]);
+  }
+  for (i = 0; i < profile->nsettings; ++i) {
+    const char *value;
+    if (strcmp(profile->settings[i].key, "memoize-env") != 0)
+      continue;
+    fputs("\nenv ", f);
+    put_escaped(f, profile->settings[i].value);
+    value = getenv(profile->settings[i].value);
+    if (value != NULL) {
+      fputc('=', f);
+      put_escaped(f, value);
+    }
+  }
+  for (i = 0; i < ninputs; ++i) {
+    fputs("\ninput ", f);
+    put_escaped(f, inputs[i]);
+    if (hash_file(memo, inputs[i], hex) == 0)
+      fprintf(f, " %s", hex);
+    else if (errno == ENOENT)
+      fputs(" -", f);
+    else
+      ok = -1;
+  }
+  for (i = 0; i < memo->noutputs; ++i) {
+    fputs("\noutput ", f);
+    put_escaped(f, memo->outputs[i]);
+  }
+  fputc('\n', f);
+  if (fclose(f) != 0)
+    die("open_memstream");
+  free(inputs);
+
+  if (ok == 0) {
+    nacl_sha256_init(&ctx);
+    nacl_sha256_update(&ctx, memo->text, memo->text_len);
+    nacl_sha256_hex(&ctx, memo->key);
+  }
+  return ok;
+}
+
+static int copy_fd(int in, int out) {
+  char buf[1 << 16];
+  ssize_t n;
+  while ((n = read(in, buf, sizeof(buf))) != 0) {
+    char *p = buf;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    while (n > 0) {
+      ssize_t written = write(out, p, n);
+      if (written < 0) {
+        if (errno == EINTR)
+          continue;
+        return -1;
+      }
+      p += written;
+      n -= written;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Copy what's in FD into the store, and set HEX to its name there.
+ */
+static int store_object(const struct memo *memo, int fd,
+                        char hex[NACL_SHA256_HEX_SIZE]) {
+  char *tmp, *path;
+  int out, ok;
+
+  tmp = store_path(memo, "objects", ".XXXXXX");
+  out = mkostemp(tmp, O_CLOEXEC);
+  if (out < 0) {
+    free(tmp);
+    return -1;
+  }
+  ok = lseek(fd, 0, SEEK_SET) == 0 && nacl_sha256_fd(fd, hex) == 0 &&
+      lseek(fd, 0, SEEK_SET) == 0 && copy_fd(fd, out) == 0 &&
+      fchmod(out, 0444) == 0;
+  ok = close(out) == 0 && ok;
+  if (ok) {
+    path = store_path(memo, "objects", hex);
+    ok = rename(tmp, path) == 0;
+    free(path);
+  }
+  if (!ok)
+    unlink(tmp);
+  free(tmp);
+  return ok ? 0 : -1;
+}
+
+/*
+ * Write FILE atomically, as a copy of the store's object HEX.
+ */
+static int restore_file(const struct memo *memo, const char *hex,
+                        const char *file, mode_t mode) {
+  char *object = store_path(memo, "objects", hex);
+  char *tmp;
+  int in, out, ok;
+
+  in = open(object, O_RDONLY | O_CLOEXEC);
+  free(object);
+  if (in < 0)
+    return -1;
+  if (asprintf(&tmp, "%s.nacl-memo.%d", file, (int) getpid()) < 0)
+    die("asprintf");
+  out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  ok = out >= 0 && copy_fd(in, out) == 0 && fchmod(out, mode) == 0;
+  ok = (out < 0 || close(out) == 0) && ok && rename(tmp, file) == 0;
+  if (!ok)
+    unlink(tmp);
+  close(in);
+  free(tmp);
+  return ok ? 0 : -1;
+}
+
+/*
+ * If the store has a result for the key, replay it and exit.  Returns if
+ * it doesn't, or if some part of it is missing.
+ */
+static void replay(const struct memo *memo, const char *nexe) {
+  char *path = store_path(memo, "results", memo->key);
+  char *line = NULL;
+  size_t linesz = 0;
+  char out_hex[NACL_SHA256_HEX_SIZE] = "", err_hex[NACL_SHA256_HEX_SIZE] = "";
+  int status = -1, pass;
+  ssize_t len;
+  FILE *f;
+
+  f = fopen(path, "re");
+  free(path);
+  if (f == NULL)
+    return;
+
+  /*
+   * The first pass checks every object is there, before touching any
+   * output; the second restores them.
+   */
+  for (pass = 0; pass < 2; ++pass) {
+    rewind(f);
+    while ((len = getline(&line, &linesz, f)) > 0) {
+      char hex[NACL_SHA256_HEX_SIZE];
+      unsigned int mode;
+      int offset;
+
+      if (line[len - 1] == '\n')
+        line[--len] = '\0';
+      if (sscanf(line, "status %d", &status) == 1)
+        continue;
+      if (sscanf(line, "stdout %64s", out_hex) == 1 ||
+          sscanf(line, "stderr %64s", err_hex) == 1)
+        continue;
+      if (sscanf(line, "output %o %64s %n", &mode, hex, &offset) == 2) {
+        char *object = store_path(memo, "objects", hex);
+        int missing = pass == 0 && access(object, R_OK) < 0;
+        free(object);
+        if (missing ||
+            (pass == 1 && restore_file(memo, hex, line + offset, mode) < 0))
+          goto fail;
+      } else if (!strncmp(line, "absent ", 7)) {
+        if (pass == 1 && unlink(line + 7) < 0 && errno != ENOENT)
+          goto fail;
+      } else {
+        goto fail;
+      }
+    }
+    if (status < 0 || out_hex[0] == '\0' || err_hex[0] == '\0')
+      goto fail;
+  }
+  fclose(f);
+  free(line);
+
+  memo_log(memo, "hit", nexe);
+  {
+    char *out_path = store_path(memo, "objects", out_hex);
+    char *err_path = store_path(memo, "objects", err_hex);
+    int out = open(out_path, O_RDONLY | O_CLOEXEC);
+    int err = open(err_path, O_RDONLY | O_CLOEXEC);
+    if (out >= 0)
+      copy_fd(out, STDOUT_FILENO);
+    if (err >= 0)
+      copy_fd(err, STDERR_FILENO);
+  }
+  exit(status);
+
+ fail:
+  fclose(f);
+  free(line);
+}
+
+/*
+ * Pass what the loader writes to OUT and ERR on to our own standard
+ * output and error, keeping a copy in each of CAPTURE.  W is watched
+ * meanwhile.
+ */
+static void pass_through(int out, int err, const int *capture,
+                         struct watch *w, const char *platform,
+                         const char *nexe) {
+  struct pollfd fds[3] = { { out, POLLIN, 0 }, { err, POLLIN, 0 },
+                           { w->pidfd, POLLIN, 0 } };
+  static const int targets[2] = { STDOUT_FILENO, STDERR_FILENO };
+  char buf[1 << 16];
+  int open_fds = 2;
+
+  while (open_fds > 0) {
+    int i;
+    fds[2].fd = w->pidfd;
+    if (poll(fds, 3, watch_timeout(w)) < 0) {
+      if (errno == EINTR)
+        continue;
+      die("poll");
+    }
+    watch_update(w, fds[2].fd < 0 ? 0 : fds[2].revents, platform, nexe);
+    for (i = 0; i < 2; ++i) {
+      ssize_t n;
+      if (fds[i].fd < 0 || fds[i].revents == 0)
+        continue;
+      n = read(fds[i].fd, buf, sizeof(buf));
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0) {
+        close(fds[i].fd);
+        fds[i].fd = -1;
+        --open_fds;
+        continue;
+      }
+      if (write(targets[i], buf, n) < 0) {
+        /* Our reader went away; keep recording anyway.  */
+      }
+      if (write(capture[i], buf, n) != n)
+        die("capturing output");
+    }
+  }
+}
+
+/*
+ * Record the loader's exit STATUS, its output in CAPTURE and the output
+ * files under the key.
+ */
+static void record(const struct memo *memo, int status, const int *capture,
+                   const char *nexe) {
+  char out_hex[NACL_SHA256_HEX_SIZE], err_hex[NACL_SHA256_HEX_SIZE];
+  char *result, *path, *tmp;
+  size_t size, i;
+  FILE *f;
+
+  if (!WIFEXITED(status) ||
+      store_object(memo, capture[0], out_hex) < 0 ||
+      store_object(memo, capture[1], err_hex) < 0)
+    return;
+
+  f = open_memstream(&result, &size);
+  if (f == NULL)
+    die("open_memstream");
+  fprintf(f, "status %d\nstdout %s\nstderr %s\n", WEXITSTATUS(status),
+          out_hex, err_hex);
+  for (i = 0; i < memo->noutputs; ++i) {
+    char hex[NACL_SHA256_HEX_SIZE];
+    struct stat st;
+    int fd = open(memo->outputs[i], O_RDONLY | O_CLOEXEC);
+    if (fd < 0 && errno == ENOENT) {
+      fprintf(f, "absent %s\n", memo->outputs[i]);
+      continue;
+    }
+    if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+        store_object(memo, fd, hex) < 0) {
+      if (fd >= 0)
+        close(fd);
+      fclose(f);
+      free(result);
+      return;
+    }
+    close(fd);
+    fprintf(f, "output %o %s %s\n", (unsigned int) (st.st_mode & 0777), hex,
+            memo->outputs[i]);
+  }
+  if (fclose(f) != 0)
+    die("open_memstream");
+
+  /*
+   * The key text goes in first, so every result can be explained.
+   */
+  path = store_path(memo, "results", memo->key);
+  if (asprintf(&tmp, "%s.%d", path, (int) getpid()) < 0)
+    die("asprintf");
+  {
+    char *key_path;
+    if (asprintf(&key_path, "%s.key", path) < 0)
+      die("asprintf");
+    f = fopen(tmp, "we");
+    if (f != NULL &&
+        fwrite(memo->text, 1, memo->text_len, f) == memo->text_len &&
+        fclose(f) == 0 && rename(tmp, key_path) == 0 &&
+        (f = fopen(tmp, "we")) != NULL &&
+        fwrite(result, 1, size, f) == size && fclose(f) == 0 &&
+        rename(tmp, path) == 0)
+      memo_log(memo, "record", nexe);
+    else
+      unlink(tmp);
+    free(key_path);
+  }
+  free(tmp);
+  free(path);
+  free(result);
+}
+
+/*
+ * Set up memoization for ARGV if PROFILE asks for it.  Returns 0 if the
+ * launch is to be memoized.
+ */
+static int memo_prepare(struct memo *memo, const struct profile *profile,
+                        int argc, char **argv) {
+  static const char *const subdirs[] = { "objects", "results", "ids" };
+  size_t i;
+
+  memo->store = profile_get(profile, "memoize");
+  if (memo->store == NULL || memo->store[0] == '\0')
+    return -1;
+  if (mkdir(memo->store, 0755) < 0 && errno != EEXIST)
+    die(memo->store);
+  for (i = 0; i < sizeof(subdirs) / sizeof(subdirs[0]); ++i) {
+    char *dir;
+    if (asprintf(&dir, "%s/%s", memo->store, subdirs[i]) < 0)
+      die("asprintf");
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+      die(dir);
+    free(dir);
+  }
+  if (build_key(memo, profile, argc, argv) < 0) {
+    memo_log(memo, "skip", argv[3]);
+    return -1;
+  }
+  return 0;
+}
+
+static void explain(const struct memo *memo) {
+  char *path = store_path(memo, "results", memo->key);
+  fwrite(memo->text, 1, memo->text_len, stdout);
+  printf("key %s\n%s\n", memo->key, access(path, F_OK) == 0 ? "hit" : "miss");
+  free(path);
+}
+
+/*
+ * Exit just as the loader did, so our parent can't tell we were here.
+ */
+static void exit_like(int status) {
+  if (WIFSIGNALED(status)) {
+    signal(WTERMSIG(status), SIG_DFL);
+    raise(WTERMSIG(status));
+  }
+  exit(WIFEXITED(status) ? WEXITSTATUS(status) : 127);
+}
+
+int main(int argc, char **argv) {
+  struct profile profile;
+  struct memo memo;
+  struct watch watch;
+  const char *parent, *nexe;
+  char *dir = NULL;
+  int explaining = argc > 1 && !strcmp(argv[1], "--explain");
+  int memoizing, watching;
+  int stdio[3], pipes[2][2], capture[2];
+  double start;
+  pid_t pid;
+  int status;
+
+  if (explaining) {
+    --argc;
+    ++argv;
+  }
+  if (argc < 4) {
+    fprintf(stderr, "Usage: %s [--explain] LOADER PLATFORM NEXE ARGS...\n",
+            progname);
+    return 127;
+  }
+  nexe = argv[3];
+
+  read_profile(&profile);
+  memoizing = memo_prepare(&memo, &profile, argc, argv) == 0;
+  if (explaining) {
+    if (!memoizing) {
+      fprintf(stderr, "%s: %s is not memoized\n", progname, nexe);
+      return 1;
+    }
+    explain(&memo);
+    return 0;
+  }
+  if (memoizing) {
+    replay(&memo, nexe);
+    memo_log(&memo, "miss", nexe);
+  }
+
+  parent = profile_get(&profile, "cgroup");
+  if (parent == NULL)
+    parent = getenv("NACL_INTERP_CGROUP");
+  if (parent != NULL && parent[0] == '\0')
+    parent = NULL;
+  argv[3] = (char *) mirror_nexe(nexe);
+  report_launch(argv[3]);
+  watching = watch_prepare(&watch, &profile, argv[3]) == 0;
+  if (parent == NULL && !memoizing && !watching) {
+    execv(argv[1], &argv[1]);
+    die(argv[1]);
+  }
+
+  if (parent != NULL)
+    dir = make_cgroup(parent, nexe, &profile);
+  if (memoizing) {
+    stdio[0] = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (stdio[0] < 0 || pipe2(pipes[0], O_CLOEXEC) < 0 ||
+        pipe2(pipes[1], O_CLOEXEC) < 0 ||
+        (capture[0] = memfd_create("nacl-memo-stdout", MFD_CLOEXEC)) < 0 ||
+        (capture[1] = memfd_create("nacl-memo-stderr", MFD_CLOEXEC)) < 0)
+      die("memoize");
+    stdio[1] = pipes[0][1];
+    stdio[2] = pipes[1][1];
+  }
+  start = now(CLOCK_MONOTONIC);
+  pid = start_loader(&dir, &argv[1], memoizing ? stdio : NULL);
+  forward_signals(pid);
+  if (watching)
+    watch_start(&watch, pid);
+  if (memoizing) {
+    /*
+     * The loader has its own SIGPIPE disposition by now; ours mustn't
+     * kill us before we've recorded.
+     */
+    signal(SIGPIPE, SIG_IGN);
+    close(stdio[0]);
+    close(stdio[1]);
+    close(stdio[2]);
+    pass_through(pipes[0][0], pipes[1][0], capture, &watch, argv[2], nexe);
+  }
+  watch_launch(&watch, argv[2], nexe);
+  status = wait_for_child(pid);
+
+  if (dir != NULL) {
+    report(dir, nexe, status, now(CLOCK_MONOTONIC) - start);
+
+    /*
+     * This fails if some daemonized descendant is still in there; the
+     * cgroup is left for whoever owns the parent to clean up.
+     */
+    rmdir(dir);
+  }
+
+  if (memoizing)
+    record(&memo, status, capture, nexe);
+
+  exit_like(status);
+  return 127;
+}
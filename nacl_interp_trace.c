@@ -0,0 +1,490 @@
+/*
+ * Copyright (c) 2011 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Show where a nexe's startup time goes, hop by hop along the exec chain.
+ *
+ * Usage: nacl_interp_trace [-v] NEXE ARGS...
+ *
+ * NEXE is run with the current environment (which must set
+ * NACL_INTERP_LOADER as usual) under ptrace, following every process it
+ * starts.  A seccomp filter stops only the system calls of interest:
+ * execve, open, mmap and write.  Everything else runs at full speed, and
+ * no root or perf is needed.  The startup is then split into hops at
+ * these points:
+ *
+ *      kernel exec     NEXE's execve until the interp's first instruction
+ *      do_start        until the interp's execve of the loader
+ *      loader          until the execve that starts sel_ldr
+ *      sel_ldr init    until sel_ldr opens the IRT (a path with "irt")
+ *      IRT load        until runnable-ld.so is opened
+ *      runnable-ld.so  until the nexe's first write, taken as its start
+ *      nexe main       until the last process exits
+ *
+ * A hop whose end never shows up is printed as "-", and the next hop
+ * starts from the last point seen.  The first write is only a proxy for
+ * reaching main, so it undercounts the last hops for nexes that work a
+ * while before writing anything.  Times are taken when the tracer sees
+ * each stop, so each is a few microseconds late.  With -v, every event
+ * is printed as well.
+ *
+ * Only native system calls are filtered, plus i386 ones on x86-64 (for
+ * sel_ldr_x86_32 and friends).
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * The seccomp filter returns one of these as SECCOMP_RET_DATA, so the
+ * tracer never has to know system call numbers itself.
+ */
+enum kind {
+  EV_NONE,
+  EV_EXECVE,                    /* Path in argument 0.  */
+  EV_EXECVEAT,                  /* Path in argument 1.  */
+  EV_OPEN,
+  EV_OPENAT,
+  EV_MMAP,
+  EV_WRITE,
+  EV_EXEC_DONE,                 /* PTRACE_EVENT_EXEC, not a system call.  */
+  EV_EXIT,                      /* A traced process has exited.  */
+};
+
+static const char *const kind_names[] = {
+  "?", "execve", "execveat", "open", "openat", "mmap", "write", "exec",
+  "exit",
+};
+
+struct traced_syscall {
+  int nr;
+  enum kind kind;
+};
+
+static const struct traced_syscall native_syscalls[] = {
+#ifdef __NR_execve
+  { __NR_execve, EV_EXECVE },
+#endif
+#ifdef __NR_execveat
+  { __NR_execveat, EV_EXECVEAT },
+#endif
+#ifdef __NR_open
+  { __NR_open, EV_OPEN },
+#endif
+  { __NR_openat, EV_OPENAT },
+#ifdef __NR_mmap
+  { __NR_mmap, EV_MMAP },
+#endif
+#ifdef __NR_mmap2
+  { __NR_mmap2, EV_MMAP },
+#endif
+  { __NR_write, EV_WRITE },
+};
+
+#if defined(__x86_64__)
+# define NATIVE_AUDIT_ARCH AUDIT_ARCH_X86_64
+static const struct traced_syscall i386_syscalls[] = {
+  { 11, EV_EXECVE }, { 358, EV_EXECVEAT }, { 5, EV_OPEN },
+  { 295, EV_OPENAT }, { 90, EV_MMAP }, { 192, EV_MMAP }, { 4, EV_WRITE },
+};
+#elif defined(__i386__)
+# define NATIVE_AUDIT_ARCH AUDIT_ARCH_I386
+#elif defined(__arm__)
+# define NATIVE_AUDIT_ARCH AUDIT_ARCH_ARM
+#elif defined(__aarch64__)
+# define NATIVE_AUDIT_ARCH AUDIT_ARCH_AARCH64
+#else
+# error "Don't know this machine's audit architecture!"
+#endif
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+struct event {
+  double time;
+  pid_t pid;
+  enum kind kind;
+  char *path;
+};
+
+static struct event *events;
+static size_t nevents;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void record(pid_t pid, enum kind kind, char *path) {
+  static size_t alloc;
+  if (nevents == alloc) {
+    alloc = alloc == 0 ? 1024 : alloc * 2;
+    events = realloc(events, alloc * sizeof(events[0]));
+    if (events == NULL) {
+      perror("realloc");
+      exit(1);
+    }
+  }
+  events[nevents].time = now();
+  events[nevents].pid = pid;
+  events[nevents].kind = kind;
+  events[nevents].path = path;
+  ++nevents;
+}
+
+/*
+ * Append a check for AUDIT_ARCH ARCH and its SYSCALLS to FILTER.
+ */
+static size_t add_arch(struct sock_filter *filter, size_t n, uint32_t arch,
+                       const struct traced_syscall *syscalls, size_t count) {
+  size_t i;
+
+  filter[n++] = (struct sock_filter)
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch));
+  filter[n++] = (struct sock_filter)
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, arch, 0, 2 * count + 2);
+  filter[n++] = (struct sock_filter)
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr));
+  for (i = 0; i < count; ++i) {
+    filter[n++] = (struct sock_filter)
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, syscalls[i].nr, 0, 1);
+    filter[n++] = (struct sock_filter)
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE | syscalls[i].kind);
+  }
+  filter[n++] = (struct sock_filter)
+      BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW);
+  return n;
+}
+
+static void install_filter(void) {
+  struct sock_filter filter[64];
+  struct sock_fprog prog;
+  size_t n = 0;
+
+  n = add_arch(filter, n, NATIVE_AUDIT_ARCH,
+               native_syscalls, ARRAY_SIZE(native_syscalls));
+#if defined(__x86_64__)
+  n = add_arch(filter, n, AUDIT_ARCH_I386,
+               i386_syscalls, ARRAY_SIZE(i386_syscalls));
+#endif
+  filter[n++] = (struct sock_filter)
+      BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW);
+
+  prog.len = n;
+  prog.filter = filter;
+  if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0 ||
+      prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) < 0) {
+    perror("seccomp");
+    _exit(127);
+  }
+}
+
+/*
+ * Copy a string out of PID's memory, a page at a time so that a string
+ * ending just before an unmapped page can still be read.
+ */
+static char *read_string(pid_t pid, uint64_t addr) {
+  char buf[4096 + 1];
+  size_t len = 0;
+
+  while (len < sizeof(buf) - 1) {
+    size_t chunk = 4096 - ((addr + len) & 4095);
+    struct iovec local, remote;
+    ssize_t n;
+    if (chunk > sizeof(buf) - 1 - len)
+      chunk = sizeof(buf) - 1 - len;
+    local.iov_base = buf + len;
+    local.iov_len = chunk;
+    remote.iov_base = (void *) (uintptr_t) (addr + len);
+    remote.iov_len = chunk;
+    n = process_vm_readv(pid, &local, 1, &remote, 1, 0);
+    if (n <= 0)
+      break;
+    if (memchr(buf + len, '\0', n) != NULL)
+      return strdup(buf);
+    len += n;
+  }
+
+  buf[len] = '\0';
+  return strdup(buf);
+}
+
+static void seccomp_stop(pid_t pid) {
+  struct __ptrace_syscall_info info;
+  unsigned long msg;
+  enum kind kind;
+  char *path = NULL;
+
+  if (ptrace(PTRACE_GETEVENTMSG, pid, NULL, &msg) < 0)
+    return;
+  kind = msg & SECCOMP_RET_DATA;
+
+  switch (kind) {
+    case EV_EXECVE:
+    case EV_OPEN:
+    case EV_EXECVEAT:
+    case EV_OPENAT:
+      if (ptrace(PTRACE_GET_SYSCALL_INFO, pid, sizeof(info), &info) > 0 &&
+          info.op == PTRACE_SYSCALL_INFO_SECCOMP)
+        path = read_string(pid, info.seccomp.args[
+            kind == EV_EXECVE || kind == EV_OPEN ? 0 : 1]);
+      break;
+    default:
+      break;
+  }
+
+  record(pid, kind, path);
+}
+
+static char *exe_name(pid_t pid) {
+  char link[64], target[4096];
+  ssize_t n;
+  snprintf(link, sizeof(link), "/proc/%d/exe", (int) pid);
+  n = readlink(link, target, sizeof(target) - 1);
+  if (n < 0)
+    return NULL;
+  target[n] = '\0';
+  return strdup(target);
+}
+
+/*
+ * Run the traced processes to completion, returning the root's status.
+ */
+static int trace(pid_t root) {
+  pid_t *known = NULL;
+  size_t nknown = 0, live = 1;
+  int root_status = 0;
+
+  while (live > 0) {
+    int status, sig = 0;
+    size_t i;
+    pid_t pid = waitpid(-1, &status, __WALL);
+
+    if (pid < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("waitpid");
+      exit(1);
+    }
+
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      record(pid, EV_EXIT, NULL);
+      if (pid == root)
+        root_status = status;
+      --live;
+      continue;
+    }
+    if (!WIFSTOPPED(status))
+      continue;
+
+    for (i = 0; i < nknown && known[i] != pid; ++i)
+      continue;
+    if (i == nknown) {
+      known = realloc(known, (nknown + 1) * sizeof(known[0]));
+      known[nknown++] = pid;
+      if (pid != root)
+        ++live;
+      if (WSTOPSIG(status) == SIGSTOP) {
+        /*
+         * A new process's initial stop, or our own child's raise.
+         */
+        if (pid == root)
+          ptrace(PTRACE_SETOPTIONS, root, NULL,
+                 PTRACE_O_TRACEEXEC | PTRACE_O_TRACEFORK |
+                 PTRACE_O_TRACEVFORK | PTRACE_O_TRACECLONE |
+                 PTRACE_O_TRACESECCOMP | PTRACE_O_EXITKILL);
+        ptrace(PTRACE_CONT, pid, NULL, 0);
+        continue;
+      }
+    }
+
+    switch (status >> 16) {
+      case PTRACE_EVENT_SECCOMP:
+        seccomp_stop(pid);
+        break;
+      case PTRACE_EVENT_EXEC:
+        record(pid, EV_EXEC_DONE, exe_name(pid));
+        break;
+      case PTRACE_EVENT_FORK:
+      case PTRACE_EVENT_VFORK:
+      case PTRACE_EVENT_CLONE:
+        break;
+      case 0:
+        sig = WSTOPSIG(status);
+        break;
+      default:
+        break;
+    }
+    ptrace(PTRACE_CONT, pid, NULL, sig);
+  }
+
+  free(known);
+  return root_status;
+}
+
+static const char *base_name(const char *path) {
+  const char *slash = strrchr(path, '/');
+  return slash == NULL ? path : slash + 1;
+}
+
+/*
+ * Index of the first event at or after FROM matching KIND (and with a
+ * path containing NEEDLE, if that's not NULL), or -1.
+ */
+static long find_event(long from, enum kind kind, enum kind alt,
+                       const char *needle) {
+  size_t i;
+  if (from < 0)
+    return -1;
+  for (i = from; i < nevents; ++i)
+    if ((events[i].kind == kind || events[i].kind == alt) &&
+        (needle == NULL ||
+         (events[i].path != NULL && strstr(events[i].path, needle) != NULL)))
+      return i;
+  return -1;
+}
+
+/*
+ * The execve that started sel_ldr: the last one its process made before
+ * the exec completed.
+ */
+static long find_sel_ldr(long from, long *exec_start) {
+  size_t i;
+  long j;
+  if (from < 0)
+    return -1;
+  for (i = from; i < nevents; ++i) {
+    if (events[i].kind == EV_EXEC_DONE && events[i].path != NULL &&
+        !strncmp(base_name(events[i].path), "sel_ldr", 7)) {
+      for (j = i - 1; j >= from; --j)
+        if (events[j].pid == events[i].pid &&
+            (events[j].kind == EV_EXECVE || events[j].kind == EV_EXECVEAT))
+          break;
+      *exec_start = j >= from ? j : -1;
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void print_report(double start) {
+  static const char *const hops[] = {
+    "kernel exec", "do_start", "loader", "sel_ldr init", "IRT load",
+    "runnable-ld.so", "nexe main",
+  };
+  long marks[ARRAY_SIZE(hops) + 1];
+  long first_exec, sel_ldr, sel_ldr_exec = -1, ld;
+  double last = start;
+  size_t h, i;
+
+  first_exec = find_event(0, EV_EXEC_DONE, EV_NONE, NULL);
+  sel_ldr = find_sel_ldr(first_exec, &sel_ldr_exec);
+  ld = find_event(sel_ldr, EV_OPEN, EV_OPENAT, "runnable-ld");
+
+  marks[0] = find_event(0, EV_EXECVE, EV_EXECVEAT, NULL);
+  marks[1] = first_exec;
+  marks[2] = find_event(first_exec, EV_EXECVE, EV_EXECVEAT, NULL);
+  marks[3] = sel_ldr_exec;
+  marks[4] = find_event(sel_ldr, EV_OPEN, EV_OPENAT, "irt");
+  marks[5] = ld;
+  marks[6] = find_event(ld, EV_WRITE, EV_NONE, NULL);
+  marks[7] = nevents - 1;
+  if (marks[0] >= 0)
+    last = events[marks[0]].time;
+
+  printf("%-16s %10s %12s %7s %7s\n",
+         "hop", "start ms", "duration ms", "mmaps", "opens");
+  for (h = 0; h < ARRAY_SIZE(hops); ++h) {
+    double end;
+    unsigned long mmaps = 0, opens = 0;
+
+    if (marks[h + 1] < 0) {
+      printf("%-16s %10s %12s %7s %7s\n", hops[h], "-", "-", "-", "-");
+      continue;
+    }
+    end = events[marks[h + 1]].time;
+    for (i = 0; i < nevents; ++i)
+      if (events[i].time > last && events[i].time <= end) {
+        if (events[i].kind == EV_MMAP)
+          ++mmaps;
+        else if (events[i].kind == EV_OPEN || events[i].kind == EV_OPENAT)
+          ++opens;
+      }
+    printf("%-16s %10.3f %12.3f %7lu %7lu\n", hops[h],
+           (last - start) * 1e3, (end - last) * 1e3, mmaps, opens);
+    last = end;
+  }
+  printf("%-16s %10s %12.3f\n", "total", "",
+         (events[nevents - 1].time - start) * 1e3);
+}
+
+int main(int argc, char **argv) {
+  int verbose = 0;
+  double start;
+  int status;
+  pid_t pid;
+  size_t i;
+
+  if (argc > 1 && !strcmp(argv[1], "-v")) {
+    verbose = 1;
+    ++argv;
+    --argc;
+  }
+  if (argc < 2) {
+    fprintf(stderr, "Usage: nacl_interp_trace [-v] NEXE ARGS...\n");
+    return 2;
+  }
+
+  start = now();
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return 1;
+  }
+  if (pid == 0) {
+    if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) < 0) {
+      perror("ptrace");
+      _exit(127);
+    }
+    raise(SIGSTOP);
+    install_filter();
+    execv(argv[1], &argv[1]);
+    perror(argv[1]);
+    _exit(127);
+  }
+
+  status = trace(pid);
+
+  if (verbose)
+    for (i = 0; i < nevents; ++i)
+      fprintf(stderr, "%10.3f %6d %-8s %s\n",
+              (events[i].time - start) * 1e3, (int) events[i].pid,
+              kind_names[events[i].kind],
+              events[i].path != NULL ? events[i].path : "");
+  print_report(start);
+
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  return WEXITSTATUS(status);
+}
@@ -0,0 +1,524 @@
+/*
+ * Copyright (c) 2011 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * nacl-ldconfig: work out offline the minimal library search path for
+ * each nexe, so launches don't probe library directories that mostly miss.
+ *
+ * Usage: nacl-ldconfig [-C CACHEDIR] [-x] [-p PROFILE] [-n]
+ *                      [-a DIR]... -L DIR [-L DIR]... NEXE...
+ *
+ * For each NEXE, this reads the DT_NEEDED entries of its dynamic section
+ * and those of every library in their closure, resolving each name once
+ * against the -L directories in order, just as runnable-ld.so would with
+ * --library-path.  The directories that actually supply a library, kept
+ * in their original order, resolve every name exactly as the full list
+ * does.  That list goes into a record in CACHEDIR named by the nexe's
+ * device and inode (see nacl_interp_start.h for the format), which
+ * ld-nacl-*.so.1 finds when NACL_INTERP_LDCACHE=CACHEDIR is set and hands
+ * to the loader script as NACL_INTERP_LIBRARY_PATH.  The record also lists
+ * the nexe's architecture, its PT_INTERP and each resolved library.
+ *
+ * Only DT_NEEDED is followed, so a library the nexe loads with dlopen,
+ * such as libgcc_s for unwinding or an NSS module, is found only if its
+ * directory happens to supply something else too.  Each -a DIR is
+ * appended to every recorded path, in order, for those; a nexe known to
+ * dlopen libraries from the -L directories needs them given as -a too.
+ *
+ * With -x, the record is also stored in the nexe's user.nacl.meta extended
+ * attribute, where the interp reads it with a single getxattr when
+ * NACL_INTERP_XATTR is set.  -p names the profile the nexe maps to, which
+ * the interp passes on as NACL_INTERP_PROFILE.  With -n, records are
+ * printed instead of stored.
+ */
+
+#define _GNU_SOURCE
+
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include "nacl_interp_start.h"
+
+static const char *progname = "nacl-ldconfig";
+
+/*
+ * What we need to know about one ELF file.
+ */
+struct elf_info {
+  unsigned char elfclass;
+  unsigned short machine;
+  char *interp;
+  char **needed;
+  size_t nneeded;
+};
+
+struct library {
+  char *name;
+  char *path;
+  size_t dir;                   /* Index into the search path.  */
+};
+
+struct closure {
+  struct library *libs;
+  size_t nlibs;
+  size_t alloc;
+};
+
+static void *xrealloc(void *p, size_t size) {
+  p = realloc(p, size);
+  if (p == NULL) {
+    perror(progname);
+    exit(1);
+  }
+  return p;
+}
+
+/*
+ * Map a virtual address to a file offset via the PT_LOAD headers.
+ */
+static bool vaddr_to_offset(const Elf64_Phdr *phdrs, size_t phnum,
+                            uint64_t vaddr, uint64_t *offset) {
+  size_t i;
+  for (i = 0; i < phnum; ++i)
+    if (phdrs[i].p_type == PT_LOAD &&
+        vaddr >= phdrs[i].p_vaddr &&
+        vaddr - phdrs[i].p_vaddr < phdrs[i].p_filesz) {
+      *offset = vaddr - phdrs[i].p_vaddr + phdrs[i].p_offset;
+      return true;
+    }
+  return false;
+}
+
+/*
+ * Read the program headers and dynamic section of FILE, converting the
+ * ELFCLASS32 flavor to the ELFCLASS64 structures.  Returns false with a
+ * message already printed if FILE is not a usable ELF file.
+ */
+static bool read_elf(const char *file, struct elf_info *info) {
+  struct stat st;
+  const unsigned char *image;
+  Elf64_Phdr *phdrs = NULL;
+  Elf64_Dyn *dyns = NULL;
+  size_t phnum, ndyns = 0, i;
+  uint64_t strtab = 0, strsz = 0, stroff;
+  bool ok = false;
+  int fd;
+
+  memset(info, 0, sizeof(*info));
+
+  fd = open(file, O_RDONLY | O_CLOEXEC);
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    fprintf(stderr, "%s: %s: %s\n", progname, file, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return false;
+  }
+  if ((size_t) st.st_size < sizeof(Elf32_Ehdr)) {
+    fprintf(stderr, "%s: %s: not an ELF file\n", progname, file);
+    close(fd);
+    return false;
+  }
+  image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (image == MAP_FAILED) {
+    fprintf(stderr, "%s: %s: %s\n", progname, file, strerror(errno));
+    return false;
+  }
+
+#define IN_FILE(off, size) \
+  ((off) <= (uint64_t) st.st_size && (size) <= st.st_size - (off))
+
+  if (memcmp(image, ELFMAG, SELFMAG) != 0 ||
+      image[EI_DATA] != ELFDATA2LSB ||
+      (image[EI_CLASS] != ELFCLASS32 && image[EI_CLASS] != ELFCLASS64)) {
+    fprintf(stderr, "%s: %s: not a little-endian ELF file\n", progname, file);
+    goto out;
+  }
+  info->elfclass = image[EI_CLASS];
+
+  if (info->elfclass == ELFCLASS64) {
+    const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *) image;
+    info->machine = ehdr->e_machine;
+    phnum = ehdr->e_phnum;
+    if (!IN_FILE(ehdr->e_phoff, phnum * sizeof(Elf64_Phdr)))
+      goto bad;
+    phdrs = xrealloc(NULL, phnum * sizeof(phdrs[0]));
+    memcpy(phdrs, image + ehdr->e_phoff, phnum * sizeof(phdrs[0]));
+  } else {
+    const Elf32_Ehdr *ehdr = (const Elf32_Ehdr *) image;
+    const Elf32_Phdr *ph;
+    info->machine = ehdr->e_machine;
+    phnum = ehdr->e_phnum;
+    if (!IN_FILE(ehdr->e_phoff, phnum * sizeof(Elf32_Phdr)))
+      goto bad;
+    ph = (const Elf32_Phdr *) (image + ehdr->e_phoff);
+    phdrs = xrealloc(NULL, phnum * sizeof(phdrs[0]));
+    for (i = 0; i < phnum; ++i) {
+      phdrs[i].p_type = ph[i].p_type;
+      phdrs[i].p_flags = ph[i].p_flags;
+      phdrs[i].p_offset = ph[i].p_offset;
+      phdrs[i].p_vaddr = ph[i].p_vaddr;
+      phdrs[i].p_paddr = ph[i].p_paddr;
+      phdrs[i].p_filesz = ph[i].p_filesz;
+      phdrs[i].p_memsz = ph[i].p_memsz;
+      phdrs[i].p_align = ph[i].p_align;
+    }
+  }
+
+  for (i = 0; i < phnum; ++i)
+    if (phdrs[i].p_type == PT_INTERP) {
+      if (!IN_FILE(phdrs[i].p_offset, phdrs[i].p_filesz) ||
+          phdrs[i].p_filesz == 0)
+        goto bad;
+      info->interp = strndup((const char *) image + phdrs[i].p_offset,
+                             phdrs[i].p_filesz);
+    }
+
+  for (i = 0; i < phnum; ++i)
+    if (phdrs[i].p_type == PT_DYNAMIC)
+      break;
+  if (i == phnum) {
+    ok = true;                  /* Statically linked: needs nothing.  */
+    goto out;
+  }
+  if (!IN_FILE(phdrs[i].p_offset, phdrs[i].p_filesz))
+    goto bad;
+
+  if (info->elfclass == ELFCLASS64) {
+    ndyns = phdrs[i].p_filesz / sizeof(Elf64_Dyn);
+    dyns = xrealloc(NULL, ndyns * sizeof(dyns[0]));
+    memcpy(dyns, image + phdrs[i].p_offset, ndyns * sizeof(dyns[0]));
+  } else {
+    const Elf32_Dyn *d = (const Elf32_Dyn *) (image + phdrs[i].p_offset);
+    size_t j;
+    ndyns = phdrs[i].p_filesz / sizeof(Elf32_Dyn);
+    dyns = xrealloc(NULL, ndyns * sizeof(dyns[0]));
+    for (j = 0; j < ndyns; ++j) {
+      dyns[j].d_tag = d[j].d_tag;
+      dyns[j].d_un.d_val = d[j].d_un.d_val;
+    }
+  }
+
+  for (i = 0; i < ndyns && dyns[i].d_tag != DT_NULL; ++i)
+    if (dyns[i].d_tag == DT_STRTAB)
+      strtab = dyns[i].d_un.d_ptr;
+    else if (dyns[i].d_tag == DT_STRSZ)
+      strsz = dyns[i].d_un.d_val;
+  if (!vaddr_to_offset(phdrs, phnum, strtab, &stroff) ||
+      !IN_FILE(stroff, strsz))
+    goto bad;
+
+  for (i = 0; i < ndyns && dyns[i].d_tag != DT_NULL; ++i)
+    if (dyns[i].d_tag == DT_NEEDED) {
+      const char *name = (const char *) image + stroff + dyns[i].d_un.d_val;
+      if (dyns[i].d_un.d_val >= strsz ||
+          memchr(name, '\0', strsz - dyns[i].d_un.d_val) == NULL)
+        goto bad;
+      info->needed = xrealloc(info->needed,
+                              (info->nneeded + 1) * sizeof(char *));
+      info->needed[info->nneeded++] = strdup(name);
+    }
+
+#undef IN_FILE
+
+  ok = true;
+  goto out;
+
+bad:
+  fprintf(stderr, "%s: %s: malformed ELF file\n", progname, file);
+out:
+  free(phdrs);
+  free(dyns);
+  munmap((void *) image, st.st_size);
+  return ok;
+}
+
+static void free_elf(struct elf_info *info) {
+  size_t i;
+  for (i = 0; i < info->nneeded; ++i)
+    free(info->needed[i]);
+  free(info->needed);
+  free(info->interp);
+}
+
+static const char *arch_name(const struct elf_info *info) {
+  switch (info->machine) {
+    case EM_386:
+      return "x86-32";
+    case EM_X86_64:
+      return "x86-64";
+    case EM_ARM:
+      return "arm";
+    case EM_MIPS:
+      return "mips";
+  }
+  return "unknown";
+}
+
+/*
+ * Find NAME in the first search directory holding an ELF file of the
+ * nexe's class and machine, as the dynamic linker would.
+ */
+static bool resolve(const char *name, const struct elf_info *nexe,
+                    char **dirs, size_t ndirs, struct library *lib) {
+  size_t i;
+  for (i = 0; i < ndirs; ++i) {
+    char *path;
+    struct elf_info info;
+    if (asprintf(&path, "%s/%s", dirs[i], name) < 0) {
+      perror(progname);
+      exit(1);
+    }
+    if (access(path, R_OK) == 0 && read_elf(path, &info)) {
+      bool match = (info.elfclass == nexe->elfclass &&
+                    info.machine == nexe->machine);
+      free_elf(&info);
+      if (match) {
+        lib->name = strdup(name);
+        lib->path = path;
+        lib->dir = i;
+        return true;
+      }
+    }
+    free(path);
+  }
+  return false;
+}
+
+/*
+ * Add the libraries INFO needs, and theirs in turn, to CLOSURE.
+ */
+static bool add_needed(const struct elf_info *info, const struct elf_info *nexe,
+                       char **dirs, size_t ndirs, struct closure *closure) {
+  bool ok = true;
+  size_t i, j;
+
+  for (i = 0; i < info->nneeded; ++i) {
+    struct library lib;
+    struct elf_info libinfo;
+
+    for (j = 0; j < closure->nlibs; ++j)
+      if (!strcmp(closure->libs[j].name, info->needed[i]))
+        break;
+    if (j < closure->nlibs)
+      continue;
+
+    if (!resolve(info->needed[i], nexe, dirs, ndirs, &lib)) {
+      fprintf(stderr, "%s: cannot find %s\n", progname, info->needed[i]);
+      ok = false;
+      continue;
+    }
+    if (closure->nlibs == closure->alloc) {
+      closure->alloc = closure->alloc == 0 ? 16 : closure->alloc * 2;
+      closure->libs = xrealloc(closure->libs,
+                               closure->alloc * sizeof(closure->libs[0]));
+    }
+    closure->libs[closure->nlibs++] = lib;
+
+    if (!read_elf(lib.path, &libinfo))
+      return false;
+    ok = add_needed(&libinfo, nexe, dirs, ndirs, closure) && ok;
+    free_elf(&libinfo);
+  }
+
+  return ok;
+}
+
+/*
+ * Options saying where records go.
+ */
+struct output {
+  const char *cachedir;
+  const char *profile;
+  bool xattr;
+  bool dry_run;
+};
+
+static bool store_file(const char *cachedir, const char *identity,
+                       const char *record, size_t size) {
+  char *path, *tmp;
+  bool ok = true;
+  FILE *f;
+
+  if (asprintf(&path, "%s/%s", cachedir, identity) < 0 ||
+      asprintf(&tmp, "%s/.%s.%d", cachedir, identity, (int) getpid()) < 0) {
+    perror(progname);
+    exit(1);
+  }
+
+  f = fopen(tmp, "w");
+  if (f == NULL ||
+      fwrite(record, 1, size, f) != size ||
+      fclose(f) != 0 ||
+      rename(tmp, path) < 0) {
+    fprintf(stderr, "%s: %s: %s\n", progname, path, strerror(errno));
+    unlink(tmp);
+    ok = false;
+  }
+
+  free(path);
+  free(tmp);
+  return ok;
+}
+
+static bool write_record(const struct output *output, const char *nexe,
+                         const struct elf_info *info,
+                         const struct closure *closure,
+                         char **dirs, size_t ndirs,
+                         char **extra, size_t nextra) {
+  char stamp[NACL_STAMP_SIZE];
+  char identity[NACL_STAMP_SIZE];
+  char *record = NULL;
+  size_t size = 0;
+  bool used[ndirs];
+  bool first = true;
+  bool ok = true;
+  struct stat st;
+  FILE *out;
+  size_t i, j;
+
+  if (stat(nexe, &st) < 0) {
+    fprintf(stderr, "%s: %s: %s\n", progname, nexe, strerror(errno));
+    return false;
+  }
+  format_identity(identity, st.st_dev, st.st_ino);
+  format_stamp(stamp, st.st_dev, st.st_ino,
+               st.st_mtim.tv_sec, st.st_mtim.tv_nsec, st.st_size);
+
+  memset(used, 0, sizeof(used));
+  for (i = 0; i < closure->nlibs; ++i)
+    used[closure->libs[i].dir] = true;
+
+  out = open_memstream(&record, &size);
+  if (out == NULL) {
+    perror(progname);
+    exit(1);
+  }
+  fprintf(out, NACL_RECORD_STAMP "%s\n", stamp);
+  fprintf(out, NACL_INTERP_ENV_PREFIX "LIBRARY_PATH=");
+  for (i = 0; i < ndirs; ++i)
+    if (used[i]) {
+      fprintf(out, "%s%s", first ? "" : ":", dirs[i]);
+      first = false;
+    }
+  for (i = 0; i < nextra; ++i) {
+    bool listed = false;
+    for (j = 0; j < ndirs; ++j)
+      listed = listed || (used[j] && !strcmp(dirs[j], extra[i]));
+    for (j = 0; j < i; ++j)
+      listed = listed || !strcmp(extra[j], extra[i]);
+    if (!listed) {
+      fprintf(out, "%s%s", first ? "" : ":", extra[i]);
+      first = false;
+    }
+  }
+  fprintf(out, "\n");
+  if (output->profile != NULL)
+    fprintf(out, NACL_INTERP_ENV_PREFIX "PROFILE=%s\n", output->profile);
+  fprintf(out, "arch %s\n", arch_name(info));
+  if (info->interp != NULL)
+    fprintf(out, "interp %s\n", info->interp);
+  for (i = 0; i < closure->nlibs; ++i)
+    fprintf(out, "needed %s %s\n", closure->libs[i].name,
+            closure->libs[i].path);
+  fclose(out);
+
+  if (output->dry_run) {
+    printf("# %s (%s)\n%s", nexe, identity, record);
+  } else {
+    if (output->cachedir != NULL &&
+        !store_file(output->cachedir, identity, record, size))
+      ok = false;
+    if (output->xattr &&
+        setxattr(nexe, NACL_XATTR_NAME, record, size, 0) < 0) {
+      fprintf(stderr, "%s: %s: %s: %s\n", progname, nexe, NACL_XATTR_NAME,
+              strerror(errno));
+      ok = false;
+    }
+  }
+
+  free(record);
+  return ok;
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "Usage: %s [-C CACHEDIR] [-x] [-p PROFILE] [-n] "
+          "[-a DIR]... -L DIR [-L DIR]... NEXE...\n", progname);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  struct output output = { NULL, NULL, false, false };
+  char **dirs = NULL, **extra = NULL;
+  size_t ndirs = 0, nextra = 0;
+  int status = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "C:L:a:np:x")) != -1) {
+    switch (opt) {
+      case 'a':
+        extra = xrealloc(extra, (nextra + 1) * sizeof(extra[0]));
+        extra[nextra++] = optarg;
+        break;
+      case 'C':
+        output.cachedir = optarg;
+        break;
+      case 'L':
+        dirs = xrealloc(dirs, (ndirs + 1) * sizeof(dirs[0]));
+        dirs[ndirs++] = optarg;
+        break;
+      case 'n':
+        output.dry_run = true;
+        break;
+      case 'p':
+        output.profile = optarg;
+        break;
+      case 'x':
+        output.xattr = true;
+        break;
+      default:
+        usage();
+    }
+  }
+  if ((output.cachedir == NULL && !output.xattr && !output.dry_run) ||
+      ndirs == 0 || optind == argc)
+    usage();
+
+  for (; optind < argc; ++optind) {
+    const char *nexe = argv[optind];
+    struct closure closure = { NULL, 0, 0 };
+    struct elf_info info;
+    size_t i;
+
+    if (!read_elf(nexe, &info)) {
+      status = 1;
+      continue;
+    }
+    if (!add_needed(&info, &info, dirs, ndirs, &closure) ||
+        !write_record(&output, nexe, &info, &closure, dirs, ndirs,
+                      extra, nextra))
+      status = 1;
+
+    for (i = 0; i < closure.nlibs; ++i) {
+      free(closure.libs[i].name);
+      free(closure.libs[i].path);
+    }
+    free(closure.libs);
+    free_elf(&info);
+  }
+
+  return status;
+}
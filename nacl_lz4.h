@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2011 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Packed nexes and a freestanding LZ4 block decompressor for them.
+ *
+ * A packed nexe (made by nacl-pack) is a small ELF shell with the original
+ * nexe's PT_INTERP, a PT_PHDR, a single PT_LOAD covering the whole file,
+ * and a PT_NACL_PACKED segment holding a struct nacl_packed_header
+ * followed by the LZ4-compressed original.  The kernel maps it all for
+ * us, so ld-nacl-*.so.1 can find the payload through AT_PHDR and
+ * decompress it straight out of memory.
+ *
+ * Like nacl_interp_start.h, this needs no libc and no relocations.
+ */
+
+#ifndef NACL_LZ4_H
+#define NACL_LZ4_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PT_NACL_PACKED 0x6e61636c        /* "nacl", in the PT_LOOS range.  */
+#define NACL_PACKED_MAGIC "NaClPk1"
+
+struct nacl_packed_header {
+  char magic[8];                /* NACL_PACKED_MAGIC, NUL-padded.  */
+  uint64_t size;                /* Size of the original nexe.  */
+  uint64_t compressed_size;     /* Size of the LZ4 block that follows.  */
+};
+
+typedef uint64_t __attribute__((may_alias, aligned(1))) lz4_unaligned_u64;
+
+/*
+ * Copy N bytes eight at a time, possibly writing up to seven bytes past
+ * DST + N.  The caller makes sure that's still inside the output buffer.
+ */
+static inline void lz4_wild_copy(uint8_t *dst, const uint8_t *src, size_t n) {
+  uint8_t *end = dst + n;
+  do {
+    *(lz4_unaligned_u64 *) dst = *(const lz4_unaligned_u64 *) src;
+    dst += 8;
+    src += 8;
+  } while (dst < end);
+}
+
+/*
+ * Decompress the LZ4 block SRC (SRCLEN bytes) into DST (DSTLEN bytes).
+ * Returns the number of bytes produced, or -1 if the block is malformed
+ * or would overrun either buffer.
+ */
+static inline ptrdiff_t lz4_decompress(const uint8_t *src, size_t srclen,
+                                       uint8_t *dst, size_t dstlen) {
+  const uint8_t *ip = src;
+  const uint8_t *const iend = src + srclen;
+  uint8_t *op = dst;
+  uint8_t *const oend = dst + dstlen;
+
+  while (ip < iend) {
+    unsigned int token = *ip++;
+    size_t length = token >> 4;
+    size_t offset;
+    const uint8_t *match;
+
+    if (length == 15) {
+      unsigned int b;
+      do {
+        if (ip == iend)
+          return -1;
+        b = *ip++;
+        length += b;
+      } while (b == 255);
+    }
+
+    if (length > (size_t) (iend - ip) || length > (size_t) (oend - op))
+      return -1;
+    if ((size_t) (iend - ip) >= 8 && length <= (size_t) (iend - ip) - 8 &&
+        (size_t) (oend - op) >= 8 && length <= (size_t) (oend - op) - 8) {
+      lz4_wild_copy(op, ip, length);
+      op += length;
+      ip += length;
+    } else {
+      size_t i;
+      for (i = 0; i < length; ++i)
+        *op++ = *ip++;
+    }
+
+    if (ip == iend)
+      break;                    /* The last sequence is only literals.  */
+
+    if (iend - ip < 2)
+      return -1;
+    offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (size_t) (op - dst))
+      return -1;
+    match = op - offset;
+
+    length = token & 15;
+    if (length == 15) {
+      unsigned int b;
+      do {
+        if (ip == iend)
+          return -1;
+        b = *ip++;
+        length += b;
+      } while (b == 255);
+    }
+    length += 4;
+
+    if (length > (size_t) (oend - op))
+      return -1;
+    if (offset >= 8 && (size_t) (oend - op) >= 8 &&
+        length <= (size_t) (oend - op) - 8) {
+      lz4_wild_copy(op, match, length);
+      op += length;
+    } else {
+      size_t i;
+      for (i = 0; i < length; ++i)
+        *op++ = *match++;
+    }
+  }
+
+  return op - dst;
+}
+
+#endif  /* NACL_LZ4_H */
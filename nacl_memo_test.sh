@@ -0,0 +1,60 @@
+#!/bin/sh
+# Copyright (c) 2011 The Native Client Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+#
+# Usage: nacl_memo_test.sh SUPERVISOR
+#
+# Checks that the memoize-input and memoize-output @N specs of
+# nacl_interp_supervise name the nexe's Nth argument: a launch misses
+# once its @1 input has changed, and a hit restores its @2 output.
+
+set -e
+
+supervise=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+fail() {
+  echo >&2 "nacl_memo_test.sh: $*"
+  exit 1
+}
+
+# The loader is given PLATFORM NEXE ARGS...; it acts as a nexe that
+# prints its first argument and copies it to its second.
+cat > loader <<'EOF'
+#!/bin/sh
+cat "$3"
+cp "$3" "$4"
+EOF
+chmod +x loader
+echo nexe > nexe
+mkdir profiles
+cat > profiles/test <<EOF
+memoize $dir/store
+memoize-input @1
+memoize-output @2
+EOF
+
+NACL_INTERP_PROFILE_DIR=$dir/profiles
+NACL_INTERP_PROFILE=test
+NACL_INTERP_MEMO_LOG=$dir/log
+export NACL_INTERP_PROFILE_DIR NACL_INTERP_PROFILE NACL_INTERP_MEMO_LOG
+
+launch() {
+  "$supervise" "$dir/loader" x86_64 "$dir/nexe" in.txt out.txt
+}
+
+echo one > in.txt
+[ "$(launch)" = one ] || fail "first launch"
+echo two > in.txt
+[ "$(launch)" = two ] || fail "a changed @1 input still hit"
+
+rm out.txt
+[ "$(launch)" = two ] || fail "replayed the wrong output"
+[ "$(cat out.txt 2>/dev/null)" = two ] || fail "a hit didn't restore @2"
+[ "$(awk '{ print $2 }' log | tr '\n' ' ')" = "miss record miss record hit " ] ||
+  fail "unexpected memo log: $(cat log)"
+
+echo "nacl_memo_test.sh: ok"
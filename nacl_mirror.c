@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2011 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * nacl-mirror: keep a NACL_INTERP_MIRROR directory under a size limit.
+ *
+ * Usage: nacl-mirror [-n] [-v] [-t TMP-SECONDS] -s SIZE DIR
+ *
+ * nacl_interp_supervise copies nexes into DIR and never removes anything
+ * (see mirror_nexe in nacl_interp_supervise.c).  This removes the copies launched least
+ * recently, as their atimes say, until the rest take no more than SIZE
+ * bytes of storage (K, M and G suffixes work).  Copies of nexes that have
+ * since been replaced are never launched again, so they go first in time.
+ * It also removes temporary files (.NAME.PID) left by launches that died
+ * mid-copy, once they're TMP-SECONDS old (default 3600).
+ *
+ * A launch that has already picked a copy has it open by the time it
+ * could be removed, or else fails like any launch of a nexe that has
+ * just been deleted; run this when that's acceptable, e.g. from cron.
+ * With -n, it only prints what it would remove.  With -v, it prints what
+ * it removes.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+struct entry {
+  char *name;
+  struct timespec atime;
+  unsigned long long bytes;
+};
+
+static int compare_atime(const void *a, const void *b) {
+  const struct entry *x = a, *y = b;
+  if (x->atime.tv_sec != y->atime.tv_sec)
+    return x->atime.tv_sec < y->atime.tv_sec ? -1 : 1;
+  return x->atime.tv_nsec < y->atime.tv_nsec ? -1
+      : x->atime.tv_nsec > y->atime.tv_nsec;
+}
+
+static unsigned long long parse_size(const char *s) {
+  char *end;
+  unsigned long long n = strtoull(s, &end, 0);
+  switch (*end) {
+    case 'G':
+      n <<= 10;
+    case 'M':
+      n <<= 10;
+    case 'K':
+      n <<= 10;
+  }
+  return n;
+}
+
+static bool remove_entry(int dirfd, const char *dir, const char *name,
+                         bool dry_run, bool verbose) {
+  if (dry_run || verbose)
+    printf("%s/%s\n", dir, name);
+  if (!dry_run && unlinkat(dirfd, name, 0) < 0 && errno != ENOENT) {
+    fprintf(stderr, "nacl-mirror: %s/%s: %s\n", dir, name, strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s [-n] [-v] [-t TMP-SECONDS] -s SIZE DIR\n",
+          argv0);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  unsigned long long limit = 0, total = 0;
+  unsigned long tmp_age = 3600;
+  bool dry_run = false, verbose = false, have_limit = false, ok = true;
+  struct entry *entries = NULL;
+  size_t n = 0, i;
+  struct dirent *d;
+  const char *dir;
+  time_t now;
+  DIR *dirp;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "nvt:s:")) != -1) {
+    switch (opt) {
+      case 'n':
+        dry_run = true;
+        break;
+      case 'v':
+        verbose = true;
+        break;
+      case 't':
+        tmp_age = strtoul(optarg, NULL, 0);
+        break;
+      case 's':
+        limit = parse_size(optarg);
+        have_limit = true;
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  if (argc - optind != 1 || !have_limit)
+    usage(argv[0]);
+  dir = argv[optind];
+
+  dirp = opendir(dir);
+  if (dirp == NULL) {
+    perror(dir);
+    return 1;
+  }
+  now = time(NULL);
+
+  while ((d = readdir(dirp)) != NULL) {
+    struct stat st;
+    if (fstatat(dirfd(dirp), d->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0 ||
+        !S_ISREG(st.st_mode))
+      continue;
+    if (d->d_name[0] == '.') {
+      if (now - st.st_mtime >= (time_t) tmp_age)
+        ok = remove_entry(dirfd(dirp), dir, d->d_name, dry_run, verbose) &&
+            ok;
+      continue;
+    }
+    entries = realloc(entries, (n + 1) * sizeof(entries[0]));
+    if (entries == NULL) {
+      perror("realloc");
+      return 1;
+    }
+    entries[n].name = strdup(d->d_name);
+    entries[n].atime = st.st_atim;
+    entries[n].bytes = (unsigned long long) st.st_blocks * 512;
+    total += entries[n].bytes;
+    ++n;
+  }
+
+  qsort(entries, n, sizeof(entries[0]), compare_atime);
+  for (i = 0; i < n && total > limit; ++i) {
+    ok = remove_entry(dirfd(dirp), dir, entries[i].name, dry_run, verbose) &&
+        ok;
+    total -= entries[i].bytes;
+  }
+
+  closedir(dirp);
+  return ok ? 0 : 1;
+}
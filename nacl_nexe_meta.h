@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2011 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Finding a nexe's metadata record (see nacl_interp_start.h), shared by
+ * the interp and nacl_spawn so that both apply the same record to a
+ * launch.  Unlike nacl_interp_start.h, this makes system calls, so the
+ * includer supplies them, along with PATH_MAX:
+ *      nacl_meta_stat_t        the stat structure the caller filled in
+ *      META_MTIME(st), META_MTIME_NSEC(st)
+ *                              its modification time
+ *      meta_getxattr(path, name, buf, size)
+ *      meta_open(path)         open for reading, close-on-exec
+ *      meta_read(fd, buf, size)
+ *      meta_close(fd)
+ * each returning a negative number on failure.
+ */
+
+#ifndef NACL_NEXE_META_H
+#define NACL_NEXE_META_H
+
+#include "nacl_interp_start.h"
+
+#define NACL_RECORD_SIZE 8192
+
+/*
+ * Fill PATH with DIR/DEV-INO for the file ST describes, as nacl-ldconfig
+ * names its records.
+ */
+static inline bool identity_path(char path[PATH_MAX], const char *dir,
+                                 const nacl_meta_stat_t *st) {
+  char identity[NACL_STAMP_SIZE];
+  size_t dirlen = my_strlen(dir);
+  size_t idlen = format_identity(identity, st->st_dev, st->st_ino);
+  size_t i;
+
+  if (dirlen + 1 + idlen >= PATH_MAX)
+    return false;
+  for (i = 0; i < dirlen; ++i)
+    path[i] = dir[i];
+  path[dirlen] = '/';
+  for (i = 0; i <= idlen; ++i)
+    path[dirlen + 1 + i] = identity[i];
+  return true;
+}
+
+/*
+ * Find the up-to-date record for EXECFN, whose stat is ST: first, if
+ * XATTR is set, in its NACL_XATTR_NAME extended attribute (one getxattr),
+ * then, if LDCACHE is set, in that directory.  The record is read into
+ * RECORD (NACL_RECORD_SIZE bytes), and its size stored in *SIZE.  Returns
+ * the number of environment settings for the loader put in EXPORTS, or -1
+ * if there was no up-to-date record.  That's no error: the loader just
+ * gets its defaults.  If the nexe is replaced after the stat, the
+ * record's stamp won't match ST, so a record is only used with the file
+ * it was written for.
+ */
+static inline int read_metadata(const char *xattr, const char *ldcache,
+                                const char *execfn,
+                                const nacl_meta_stat_t *st, char *record,
+                                size_t *size, const char **exports) {
+  char stamp[NACL_STAMP_SIZE];
+  char path[PATH_MAX];
+  int nexports = -1;
+  long n;
+  int fd;
+
+  format_stamp(stamp, st->st_dev, st->st_ino,
+               META_MTIME(st), META_MTIME_NSEC(st), st->st_size);
+
+  if (xattr != NULL) {
+    n = meta_getxattr(execfn, NACL_XATTR_NAME, record, NACL_RECORD_SIZE);
+    if (n > 0)
+      nexports = parse_record(record, n, stamp, exports);
+  }
+  if (nexports < 0 && ldcache != NULL &&
+      identity_path(path, ldcache, st) && (fd = meta_open(path)) >= 0) {
+    n = meta_read(fd, record, NACL_RECORD_SIZE);
+    meta_close(fd);
+    if (n > 0)
+      nexports = parse_record(record, n, stamp, exports);
+  }
+  if (nexports >= 0)
+    *size = n;
+  return nexports;
+}
+
+#endif  /* NACL_NEXE_META_H */
@@ -0,0 +1,444 @@
+/*
+ * Copyright (c) 2011 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * nacl-pack: make a packed nexe, or measure what packing buys.
+ *
+ * Usage: nacl-pack NEXE PACKED
+ *        nacl-pack -b NEXE PACKED
+ *
+ * The first form writes PACKED, a small ELF shell carrying NEXE's
+ * PT_INTERP and an LZ4-compressed copy of NEXE (see nacl_lz4.h).  Running
+ * PACKED goes through ld-nacl-*.so.1 as usual; the interp decompresses
+ * the payload into a sealed memfd and hands that to the loader in place
+ * of the file name.
+ *
+ * With -b, nothing is written.  Instead NEXE and PACKED are each dropped
+ * from the page cache and read back cold, PACKED also being decompressed,
+ * and the timings are printed along with the warm decompression cost.
+ * The cold numbers are only meaningful for files on the storage in
+ * question.
+ */
+
+#define _GNU_SOURCE
+
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nacl_lz4.h"
+
+static const char *progname = "nacl-pack";
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *xmalloc(size_t size) {
+  void *p = malloc(size);
+  if (p == NULL) {
+    perror(progname);
+    exit(1);
+  }
+  return p;
+}
+
+static void die(const char *file) {
+  fprintf(stderr, "%s: %s: %s\n", progname, file, strerror(errno));
+  exit(1);
+}
+
+/*
+ * Read all of FILE, first dropping it from the page cache if COLD.
+ */
+static uint8_t *read_file(const char *file, size_t *size, bool cold) {
+  struct stat st;
+  uint8_t *buf;
+  size_t done = 0;
+  int fd = open(file, O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0 || fstat(fd, &st) < 0)
+    die(file);
+  if (cold)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+  buf = xmalloc(st.st_size + 1);
+  while (done < (size_t) st.st_size) {
+    ssize_t n = read(fd, buf + done, st.st_size - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      die(file);
+    done += n;
+  }
+  close(fd);
+  *size = done;
+  return buf;
+}
+
+static inline uint32_t read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint8_t *put_length(uint8_t *op, size_t length) {
+  for (; length >= 255; length -= 255)
+    *op++ = 255;
+  *op++ = length;
+  return op;
+}
+
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *literals,
+                             size_t nliterals, size_t offset,
+                             size_t match_length) {
+  uint8_t *token = op++;
+  size_t ml = match_length == 0 ? 0 : match_length - 4;
+
+  *token = (nliterals < 15 ? nliterals : 15) << 4;
+  if (nliterals >= 15)
+    op = put_length(op, nliterals - 15);
+  memcpy(op, literals, nliterals);
+  op += nliterals;
+
+  if (match_length != 0) {
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    *token |= ml < 15 ? ml : 15;
+    if (ml >= 15)
+      op = put_length(op, ml - 15);
+  }
+  return op;
+}
+
+/*
+ * A simple greedy LZ4 block compressor.  DST must have room for
+ * lz4_bound(N) bytes.  It follows the format's end-of-block rules: the
+ * last five bytes are literals and no match starts in the last twelve.
+ */
+#define HASH_BITS 16
+
+static size_t lz4_bound(size_t n) {
+  return n + n / 255 + 16;
+}
+
+static size_t lz4_compress(const uint8_t *src, size_t n, uint8_t *dst) {
+  static uint32_t table[1 << HASH_BITS];
+  size_t ip = 0, anchor = 0;
+  uint8_t *op = dst;
+
+  memset(table, 0, sizeof(table));
+
+  if (n > 12) {
+    while (ip < n - 12) {
+      uint32_t seq = read32(src + ip);
+      uint32_t h = (seq * 2654435761u) >> (32 - HASH_BITS);
+      size_t ref = table[h];
+      table[h] = ip + 1;
+
+      if (ref != 0 && ip - (ref - 1) <= 65535 &&
+          read32(src + ref - 1) == seq) {
+        size_t len = 4;
+        --ref;
+        while (ip + len < n - 5 && src[ref + len] == src[ip + len])
+          ++len;
+        op = put_sequence(op, src + anchor, ip - anchor, ip - ref, len);
+        ip += len;
+        anchor = ip;
+      } else {
+        ++ip;
+      }
+    }
+  }
+
+  op = put_sequence(op, src + anchor, n - anchor, 0, 0);
+  return op - dst;
+}
+
+/*
+ * The shell's layout: headers, PT_INTERP string, then the payload.
+ */
+enum { PH_PHDR, PH_INTERP, PH_LOAD, PH_PACKED, PH_STACK, PH_COUNT };
+
+struct layout {
+  size_t phoff, phentsize;
+  size_t interp_off, interp_size;
+  size_t payload_off, payload_size;
+  size_t total;
+};
+
+static void fill_phdr(Elf64_Phdr *ph, uint32_t type, uint32_t flags,
+                      size_t offset, size_t size, size_t align) {
+  ph->p_type = type;
+  ph->p_flags = flags;
+  ph->p_offset = offset;
+  ph->p_vaddr = offset;
+  ph->p_paddr = offset;
+  ph->p_filesz = size;
+  ph->p_memsz = size;
+  ph->p_align = align;
+}
+
+/*
+ * Write the ELF header and program headers in the nexe's own class and
+ * machine, so the kernel will run the shell wherever it ran the nexe.
+ */
+static void write_headers(uint8_t *out, const uint8_t *nexe,
+                          const struct layout *l) {
+  Elf64_Phdr ph[PH_COUNT];
+  size_t i;
+
+  memset(ph, 0, sizeof(ph));
+  fill_phdr(&ph[PH_PHDR], PT_PHDR, PF_R, l->phoff,
+            PH_COUNT * l->phentsize, 8);
+  fill_phdr(&ph[PH_INTERP], PT_INTERP, PF_R, l->interp_off,
+            l->interp_size, 1);
+  fill_phdr(&ph[PH_LOAD], PT_LOAD, PF_R, 0, l->total, 0x1000);
+  fill_phdr(&ph[PH_PACKED], PT_NACL_PACKED, PF_R, l->payload_off,
+            l->payload_size, 8);
+  fill_phdr(&ph[PH_STACK], PT_GNU_STACK, PF_R | PF_W, 0, 0, 16);
+
+  if (nexe[EI_CLASS] == ELFCLASS64) {
+    Elf64_Ehdr *ehdr = (Elf64_Ehdr *) out;
+    memcpy(ehdr, nexe, sizeof(*ehdr));
+    ehdr->e_type = ET_DYN;
+    ehdr->e_entry = 0;
+    ehdr->e_phoff = l->phoff;
+    ehdr->e_shoff = 0;
+    ehdr->e_ehsize = sizeof(*ehdr);
+    ehdr->e_phentsize = sizeof(Elf64_Phdr);
+    ehdr->e_phnum = PH_COUNT;
+    ehdr->e_shentsize = 0;
+    ehdr->e_shnum = 0;
+    ehdr->e_shstrndx = SHN_UNDEF;
+    memcpy(out + l->phoff, ph, sizeof(ph));
+  } else {
+    Elf32_Ehdr *ehdr = (Elf32_Ehdr *) out;
+    Elf32_Phdr *ph32 = (Elf32_Phdr *) (out + l->phoff);
+    memcpy(ehdr, nexe, sizeof(*ehdr));
+    ehdr->e_type = ET_DYN;
+    ehdr->e_entry = 0;
+    ehdr->e_phoff = l->phoff;
+    ehdr->e_shoff = 0;
+    ehdr->e_ehsize = sizeof(*ehdr);
+    ehdr->e_phentsize = sizeof(Elf32_Phdr);
+    ehdr->e_phnum = PH_COUNT;
+    ehdr->e_shentsize = 0;
+    ehdr->e_shnum = 0;
+    ehdr->e_shstrndx = SHN_UNDEF;
+    for (i = 0; i < PH_COUNT; ++i) {
+      ph32[i].p_type = ph[i].p_type;
+      ph32[i].p_flags = ph[i].p_flags;
+      ph32[i].p_offset = ph[i].p_offset;
+      ph32[i].p_vaddr = ph[i].p_vaddr;
+      ph32[i].p_paddr = ph[i].p_paddr;
+      ph32[i].p_filesz = ph[i].p_filesz;
+      ph32[i].p_memsz = ph[i].p_memsz;
+      ph32[i].p_align = ph[i].p_align;
+    }
+  }
+}
+
+/*
+ * Find NEXE's PT_INTERP string.
+ */
+static const char *find_interp(const uint8_t *nexe, size_t size,
+                               size_t *interp_size) {
+  size_t phoff, phnum, phentsize, i;
+
+  if (size < sizeof(Elf64_Ehdr) || memcmp(nexe, ELFMAG, SELFMAG) != 0 ||
+      nexe[EI_DATA] != ELFDATA2LSB)
+    return NULL;
+
+  if (nexe[EI_CLASS] == ELFCLASS64) {
+    const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *) nexe;
+    phoff = ehdr->e_phoff;
+    phnum = ehdr->e_phnum;
+    phentsize = sizeof(Elf64_Phdr);
+  } else if (nexe[EI_CLASS] == ELFCLASS32) {
+    const Elf32_Ehdr *ehdr = (const Elf32_Ehdr *) nexe;
+    phoff = ehdr->e_phoff;
+    phnum = ehdr->e_phnum;
+    phentsize = sizeof(Elf32_Phdr);
+  } else {
+    return NULL;
+  }
+  if (phoff > size || phnum * phentsize > size - phoff)
+    return NULL;
+
+  for (i = 0; i < phnum; ++i) {
+    const uint8_t *p = nexe + phoff + i * phentsize;
+    uint32_t type;
+    size_t offset, filesz;
+    memcpy(&type, p, sizeof(type));
+    if (type != PT_INTERP)
+      continue;
+    if (nexe[EI_CLASS] == ELFCLASS64) {
+      const Elf64_Phdr *ph = (const Elf64_Phdr *) p;
+      offset = ph->p_offset;
+      filesz = ph->p_filesz;
+    } else {
+      const Elf32_Phdr *ph = (const Elf32_Phdr *) p;
+      offset = ph->p_offset;
+      filesz = ph->p_filesz;
+    }
+    if (offset > size || filesz > size - offset || filesz == 0 ||
+        nexe[offset + filesz - 1] != '\0')
+      return NULL;
+    *interp_size = filesz;
+    return (const char *) nexe + offset;
+  }
+  return NULL;
+}
+
+static int pack(const char *input, const char *output) {
+  struct nacl_packed_header header;
+  struct layout l;
+  const char *interp;
+  uint8_t *nexe, *compressed, *check, *out;
+  size_t size, csize;
+  FILE *f;
+
+  nexe = read_file(input, &size, false);
+  interp = find_interp(nexe, size, &l.interp_size);
+  if (interp == NULL) {
+    fprintf(stderr, "%s: %s: not a dynamically-linked ELF nexe\n",
+            progname, input);
+    return 1;
+  }
+
+  compressed = xmalloc(lz4_bound(size));
+  csize = lz4_compress(nexe, size, compressed);
+
+  check = xmalloc(size + 1);
+  if (lz4_decompress(compressed, csize, check, size) != (ptrdiff_t) size ||
+      memcmp(check, nexe, size) != 0) {
+    fprintf(stderr, "%s: %s: compression did not round-trip\n",
+            progname, input);
+    return 1;
+  }
+  free(check);
+
+  l.phentsize = nexe[EI_CLASS] == ELFCLASS64 ?
+                sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+  l.phoff = nexe[EI_CLASS] == ELFCLASS64 ?
+            sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr);
+  l.interp_off = l.phoff + PH_COUNT * l.phentsize;
+  l.payload_off = (l.interp_off + l.interp_size + 7) & -8;
+  l.payload_size = sizeof(header) + csize;
+  l.total = l.payload_off + l.payload_size;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, NACL_PACKED_MAGIC, sizeof(NACL_PACKED_MAGIC));
+  header.size = size;
+  header.compressed_size = csize;
+
+  out = calloc(1, l.total);
+  if (out == NULL) {
+    perror(progname);
+    return 1;
+  }
+  write_headers(out, nexe, &l);
+  memcpy(out + l.interp_off, interp, l.interp_size);
+  memcpy(out + l.payload_off, &header, sizeof(header));
+  memcpy(out + l.payload_off + sizeof(header), compressed, csize);
+
+  f = fopen(output, "w");
+  if (f == NULL || fwrite(out, 1, l.total, f) != l.total || fclose(f) != 0)
+    die(output);
+  chmod(output, 0755);
+
+  printf("%s: %zu -> %zu bytes (%.1f%%)\n", output, size, l.total,
+         100.0 * l.total / size);
+  return 0;
+}
+
+/*
+ * Find the payload in a packed file, as the interp does from its
+ * program headers, but here just by trusting our own layout.
+ */
+static const struct nacl_packed_header *find_payload(const uint8_t *packed,
+                                                     size_t size) {
+  size_t i;
+  for (i = 0; i + sizeof(struct nacl_packed_header) <= size; i += 8) {
+    const struct nacl_packed_header *h =
+        (const struct nacl_packed_header *) (packed + i);
+    if (!memcmp(h->magic, NACL_PACKED_MAGIC, sizeof(NACL_PACKED_MAGIC)) &&
+        h->compressed_size <= size - i - sizeof(*h))
+      return h;
+  }
+  return NULL;
+}
+
+static int bench(const char *input, const char *packed_file) {
+  const struct nacl_packed_header *h;
+  uint8_t *nexe, *packed, *out;
+  size_t size, packed_size;
+  double t0, cold_plain, cold_packed, warm = 0;
+  int i, reps = 5;
+
+  t0 = now();
+  nexe = read_file(input, &size, true);
+  cold_plain = now() - t0;
+
+  t0 = now();
+  packed = read_file(packed_file, &packed_size, true);
+  h = find_payload(packed, packed_size);
+  if (h == NULL) {
+    fprintf(stderr, "%s: %s: not a packed nexe\n", progname, packed_file);
+    return 1;
+  }
+  out = xmalloc(h->size);
+  if (lz4_decompress((const uint8_t *) (h + 1), h->compressed_size,
+                     out, h->size) != (ptrdiff_t) h->size) {
+    fprintf(stderr, "%s: %s: corrupt payload\n", progname, packed_file);
+    return 1;
+  }
+  cold_packed = now() - t0;
+
+  if (h->size != size || memcmp(out, nexe, size) != 0) {
+    fprintf(stderr, "%s: %s does not hold %s\n", progname, packed_file, input);
+    return 1;
+  }
+
+  for (i = 0; i < reps; ++i) {
+    t0 = now();
+    lz4_decompress((const uint8_t *) (h + 1), h->compressed_size,
+                   out, h->size);
+    warm += now() - t0;
+  }
+  warm /= reps;
+
+  printf("nexe size          %zu bytes\n", size);
+  printf("packed size        %zu bytes (%.1f%%)\n", packed_size,
+         100.0 * packed_size / size);
+  printf("cold read, plain   %.3f ms\n", cold_plain * 1e3);
+  printf("cold read, packed  %.3f ms (including decompression)\n",
+         cold_packed * 1e3);
+  printf("warm decompression %.3f ms (%.0f MB/s)\n", warm * 1e3,
+         size / warm / 1e6);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc == 4 && !strcmp(argv[1], "-b"))
+    return bench(argv[2], argv[3]);
+  if (argc == 3)
+    return pack(argv[1], argv[2]);
+  fprintf(stderr, "Usage: %s NEXE PACKED\n       %s -b NEXE PACKED\n",
+          progname, progname);
+  return 2;
+}
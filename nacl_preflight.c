@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2011 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * nacl-preflight: check, or warm, everything a launch will use, for
+ * deploy hooks.
+ *
+ * Usage: nacl-preflight [-w] [-L LOADER] [PLATFORM...]
+ *
+ * For each PLATFORM (by default the one ld-nacl-*.so.1 would assume on
+ * this machine), the loader is asked for the sel_ldr command it would run
+ * ("LOADER --print-command PLATFORM"; see nacl_interp_loader_sdk.sh).
+ * LOADER defaults to $NACL_INTERP_LOADER.  The loader and every absolute
+ * path in that command are the artifacts a launch needs: each is a file,
+ * or a directory (such as the --library-path) whose files all count.
+ * Each artifact is opened and mapped, and with -w read into the page
+ * cache as well.  Then a line goes to stdout for it, with these fields
+ * separated by tabs:
+ *      PLATFORM USEC RESIDENT PAGES PATH
+ * USEC is how long opening and mapping (and warming) it took; RESIDENT is
+ * how many of its PAGES are in the page cache afterwards, per mincore.  A
+ * missing artifact gets "-" for the numbers and makes the exit status 1.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nacl_interp_start.h"
+
+extern char **environ;
+
+static bool warm;
+static long page_size;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static unsigned long resident_pages(void *image, unsigned long pages) {
+  static unsigned char vec[4096];
+  unsigned long resident = 0, done, i;
+
+  for (done = 0; done < pages; done += sizeof(vec)) {
+    unsigned long n = pages - done < sizeof(vec) ? pages - done : sizeof(vec);
+    if (mincore((char *) image + done * page_size, n * page_size, vec) < 0)
+      break;
+    for (i = 0; i < n; ++i)
+      resident += vec[i] & 1;
+  }
+  return resident;
+}
+
+/*
+ * Check (and, with -w, warm) one file.  Returns 1 if it's missing.  In a
+ * directory, anything but a regular file is just passed over.
+ */
+static int preflight_file(const char *platform, const char *path,
+                          bool in_directory) {
+  unsigned long pages = 0, resident = 0;
+  double start = now(), usec;
+  struct stat st;
+  int fd;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    if (fd >= 0)
+      close(fd);
+    if (in_directory)
+      return 0;
+    printf("%s\t-\t-\t-\t%s\n", platform, path);
+    return 1;
+  }
+  if (in_directory && !S_ISREG(st.st_mode)) {
+    close(fd);
+    return 0;
+  }
+
+  if (S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *image = mmap(NULL, st.st_size, PROT_READ,
+                       MAP_PRIVATE | (warm ? MAP_POPULATE : 0), fd, 0);
+    usec = (now() - start) * 1e6;
+    if (image != MAP_FAILED) {
+      pages = (st.st_size + page_size - 1) / page_size;
+      resident = resident_pages(image, pages);
+      munmap(image, st.st_size);
+    }
+  } else {
+    usec = (now() - start) * 1e6;
+  }
+  close(fd);
+
+  printf("%s\t%.0f\t%lu\t%lu\t%s\n", platform, usec, resident, pages, path);
+  return 0;
+}
+
+static int preflight_directory(const char *platform, const char *dir) {
+  struct dirent *d;
+  int failures = 0;
+  DIR *dirp = opendir(dir);
+
+  if (dirp == NULL)
+    return preflight_file(platform, dir, false);
+  while ((d = readdir(dirp)) != NULL) {
+    char *member;
+    if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, ".."))
+      continue;
+    if (asprintf(&member, "%s/%s", dir, d->d_name) < 0) {
+      perror("asprintf");
+      exit(2);
+    }
+    failures += preflight_file(platform, member, true);
+    free(member);
+  }
+  closedir(dirp);
+  return failures;
+}
+
+/*
+ * Run LOADER --print-command PLATFORM, and return what it prints, or NULL
+ * if it didn't exit successfully.
+ */
+static char *loader_command(const char *loader, const char *platform) {
+  char *const argv[] = {
+    (char *) loader, (char *) "--print-command", (char *) platform, NULL
+  };
+  posix_spawn_file_actions_t actions;
+  char *buf = NULL;
+  size_t len = 0, size = 0;
+  ssize_t n;
+  int fds[2], status = -1;
+  pid_t pid;
+
+  if (pipe2(fds, O_CLOEXEC) < 0)
+    return NULL;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+  if (posix_spawn(&pid, loader, &actions, NULL, argv, environ) != 0)
+    pid = -1;
+  posix_spawn_file_actions_destroy(&actions);
+  close(fds[1]);
+  for (;;) {
+    if (size - len < 256) {
+      buf = realloc(buf, size = size == 0 ? 4096 : size * 2);
+      if (buf == NULL) {
+        perror("realloc");
+        exit(2);
+      }
+    }
+    n = read(fds[0], buf + len, size - len - 1);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    len += n;
+  }
+  close(fds[0]);
+  buf[len] = '\0';
+  if (pid > 0)
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+      continue;
+  if (status != 0) {
+    free(buf);
+    return NULL;
+  }
+  return buf;
+}
+
+static int preflight(const char *loader, const char *platform) {
+  int failures = preflight_file(platform, loader, false);
+  char *command = loader_command(loader, platform);
+  char *p;
+
+  if (command == NULL) {
+    fprintf(stderr, "nacl-preflight: cannot get the command for %s from %s\n",
+            platform, loader);
+    return failures + 1;
+  }
+
+  /*
+   * One word per line; a word may be a colon-separated list of paths.
+   */
+  for (p = command; *p != '\0';) {
+    char *word = p;
+    p += strcspn(p, "\n:");
+    if (*p != '\0')
+      *p++ = '\0';
+    if (word[0] == '/')
+      failures += preflight_directory(platform, word);
+  }
+  free(command);
+  return failures;
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s [-w] [-L LOADER] [PLATFORM...]\n", argv0);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  const char *loader = getenv(NACL_INTERP_ENV_PREFIX "LOADER");
+  int failures = 0;
+  int opt, i;
+
+  while ((opt = getopt(argc, argv, "wL:")) != -1) {
+    switch (opt) {
+      case 'w':
+        warm = true;
+        break;
+      case 'L':
+        loader = optarg;
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  if (loader == NULL) {
+    fprintf(stderr, "nacl-preflight: no -L, and " NACL_INTERP_ENV_PREFIX
+            "LOADER is not set\n");
+    return 2;
+  }
+  page_size = sysconf(_SC_PAGESIZE);
+
+  if (optind == argc)
+    failures = preflight(loader, default_platform());
+  for (i = optind; i < argc; ++i)
+    failures += preflight(loader, argv[i]);
+  return failures != 0;
+}
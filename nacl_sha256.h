@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2011 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * SHA-256, for the host tools' content-addressed stores.
+ */
+
+#ifndef NACL_SHA256_H
+#define NACL_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define NACL_SHA256_SIZE 32
+#define NACL_SHA256_HEX_SIZE (2 * NACL_SHA256_SIZE + 1)
+
+struct nacl_sha256 {
+  uint32_t state[8];
+  uint64_t length;
+  uint8_t block[64];
+  size_t used;
+};
+
+void nacl_sha256_init(struct nacl_sha256 *ctx);
+void nacl_sha256_update(struct nacl_sha256 *ctx, const void *data, size_t len);
+void nacl_sha256_final(struct nacl_sha256 *ctx,
+                       uint8_t digest[NACL_SHA256_SIZE]);
+
+/*
+ * Finish CTX and write the digest as lowercase hex, NUL-terminated.
+ */
+void nacl_sha256_hex(struct nacl_sha256 *ctx, char hex[NACL_SHA256_HEX_SIZE]);
+
+/*
+ * Hash everything read from FD.  Returns 0, or -1 with errno set.
+ */
+int nacl_sha256_fd(int fd, char hex[NACL_SHA256_HEX_SIZE]);
+
+#endif  /* NACL_SHA256_H */
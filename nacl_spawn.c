@@ -0,0 +1,482 @@
+/*
+ * Copyright (c) 2011 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * See nacl_spawn.h.  glibc's posix_spawn runs the child with
+ * clone(CLONE_VM|CLONE_VFORK), so no page tables are copied however large
+ * the caller is; that is why it's used here rather than fork.
+ */
+
+#define _GNU_SOURCE
+
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/auxv.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include "nacl_interp_start.h"
+#include "nacl_lz4.h"
+#include "nacl_spawn.h"
+
+extern char **environ;
+
+/*
+ * The interp's lookup of per-nexe metadata records.
+ */
+typedef struct stat nacl_meta_stat_t;
+#define META_MTIME(st) ((st)->st_mtim.tv_sec)
+#define META_MTIME_NSEC(st) ((st)->st_mtim.tv_nsec)
+#define meta_getxattr getxattr
+#define meta_open(path) open((path), O_RDONLY | O_CLOEXEC)
+#define meta_read read
+#define meta_close close
+#include "nacl_nexe_meta.h"
+
+static void free_words(char **words, size_t n) {
+  size_t i;
+  for (i = 0; i < n; ++i)
+    free(words[i]);
+  free(words);
+}
+
+/*
+ * Read all of FD into a NUL-terminated buffer.
+ */
+static int read_all(int fd, char **result) {
+  char *buf = NULL;
+  size_t len = 0, alloc = 0;
+
+  for (;;) {
+    ssize_t n;
+    if (alloc - len < 256) {
+      char *bigger = realloc(buf, alloc = alloc == 0 ? 1024 : alloc * 2);
+      if (bigger == NULL) {
+        free(buf);
+        return ENOMEM;
+      }
+      buf = bigger;
+    }
+    n = read(fd, buf + len, alloc - len - 1);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      int error = errno;
+      free(buf);
+      return error;
+    }
+    if (n == 0)
+      break;
+    len += n;
+  }
+
+  buf[len] = '\0';
+  *result = buf;
+  return 0;
+}
+
+/*
+ * Run "LOADER --print-command PLATFORM" and split its output into lines.
+ */
+static int resolve_command(struct nacl_spawn_config *config) {
+  char *const argv[] = {
+    config->loader, (char *) "--print-command", config->platform, NULL
+  };
+  posix_spawn_file_actions_t actions;
+  char *output = NULL, *line, *next;
+  int fds[2];
+  int error, status;
+  pid_t pid = 0;
+
+  if (pipe2(fds, O_CLOEXEC) < 0)
+    return errno;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+  error = posix_spawn(&pid, config->loader, &actions, NULL, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(fds[1]);
+  if (error == 0)
+    error = read_all(fds[0], &output);
+  close(fds[0]);
+  if (pid > 0) {
+    while (waitpid(pid, &status, 0) < 0)
+      if (errno != EINTR) {
+        status = -1;
+        break;
+      }
+    if (error == 0 && (!WIFEXITED(status) || WEXITSTATUS(status) != 0))
+      error = ENOEXEC;
+  }
+  if (error != 0) {
+    free(output);
+    return error;
+  }
+
+  for (line = output; *line != '\0'; line = next) {
+    char **bigger;
+    next = strchrnul(line, '\n');
+    if (*next != '\0')
+      *next++ = '\0';
+    bigger = realloc(config->command,
+                     (config->ncommand + 1) * sizeof(config->command[0]));
+    if (bigger == NULL || (line = strdup(line)) == NULL) {
+      free(output);
+      return ENOMEM;
+    }
+    config->command = bigger;
+    config->command[config->ncommand++] = line;
+  }
+  free(output);
+
+  return config->ncommand == 0 ? ENOEXEC : 0;
+}
+
+/*
+ * Set *COPY to a copy of the environment variable NACL_INTERP_NAME, if
+ * it's set.  Returns false if it couldn't be copied.
+ */
+static bool copy_variable(char **copy, const char *name) {
+  char variable[64];
+  const char *value;
+
+  snprintf(variable, sizeof(variable), NACL_INTERP_ENV_PREFIX "%s", name);
+  value = getenv(variable);
+  *copy = value == NULL ? NULL : strdup(value);
+  return value == NULL || *copy != NULL;
+}
+
+int nacl_spawn_config_init(struct nacl_spawn_config *config,
+                           const char *loader, const char *platform,
+                           int flags) {
+  const char *supervisor;
+  int error = 0;
+
+  memset(config, 0, sizeof(*config));
+
+  if (getauxval(AT_SECURE))
+    return EPERM;
+  if (loader == NULL)
+    loader = getenv(NACL_INTERP_ENV_PREFIX "LOADER");
+  if (loader == NULL)
+    return EINVAL;
+  if (platform == NULL)
+    platform = default_platform();
+
+  supervisor = getenv(NACL_INTERP_ENV_PREFIX "SUPERVISOR");
+  if (supervisor != NULL && supervisor[0] == '\0')
+    supervisor = NULL;
+
+  config->loader = strdup(loader);
+  config->platform = strdup(platform);
+  if (supervisor != NULL)
+    config->supervisor = strdup(supervisor);
+  if (config->loader == NULL || config->platform == NULL ||
+      (supervisor != NULL && config->supervisor == NULL) ||
+      !copy_variable(&config->xattr, "XATTR") ||
+      !copy_variable(&config->ldcache, "LDCACHE"))
+    error = ENOMEM;
+  else if ((flags & NACL_SPAWN_DIRECT) && supervisor == NULL)
+    error = resolve_command(config);
+
+  if (error != 0)
+    nacl_spawn_config_destroy(config);
+  return error;
+}
+
+void nacl_spawn_config_destroy(struct nacl_spawn_config *config) {
+  free(config->loader);
+  free(config->platform);
+  free(config->supervisor);
+  free(config->xattr);
+  free(config->ldcache);
+  free_words(config->command, config->ncommand);
+  memset(config, 0, sizeof(*config));
+}
+
+static int count_args(char *const argv[]) {
+  int argc = 0;
+  while (argv[argc] != NULL)
+    ++argc;
+  return argc;
+}
+
+/*
+ * Slots for the command of any launch: even in direct mode, a launch with
+ * a metadata record runs the loader.
+ */
+static size_t command_size(const struct nacl_spawn_config *config,
+                           int argc) {
+  size_t size;
+  if (argc == 0)
+    argc = 1;                   /* See spawn_command.  */
+  size = loader_argv_size(argc);
+  if (config->command != NULL && config->ncommand + argc + 1 > size)
+    size = config->ncommand + argc + 1;
+  return size;
+}
+
+/*
+ * Is the file open on FD packed by nacl-pack (see nacl_lz4.h)?
+ */
+static int is_packed(int fd) {
+  unsigned char ident[EI_NIDENT];
+  uint64_t phoff;
+  uint16_t phnum, phentsize, i;
+  int packed = 0;
+
+  if (pread(fd, ident, sizeof(ident), 0) == sizeof(ident) &&
+      !memcmp(ident, ELFMAG, SELFMAG)) {
+    if (ident[EI_CLASS] == ELFCLASS64) {
+      Elf64_Ehdr ehdr;
+      if (pread(fd, &ehdr, sizeof(ehdr), 0) != sizeof(ehdr))
+        goto out;
+      phoff = ehdr.e_phoff;
+      phnum = ehdr.e_phnum;
+      phentsize = ehdr.e_phentsize;
+    } else {
+      Elf32_Ehdr ehdr;
+      if (pread(fd, &ehdr, sizeof(ehdr), 0) != sizeof(ehdr))
+        goto out;
+      phoff = ehdr.e_phoff;
+      phnum = ehdr.e_phnum;
+      phentsize = ehdr.e_phentsize;
+    }
+    /*
+     * p_type comes first in both classes' program headers.
+     */
+    for (i = 0; i < phnum && !packed; ++i) {
+      uint32_t type;
+      if (pread(fd, &type, sizeof(type), phoff + (uint64_t) i * phentsize)
+          != sizeof(type))
+        break;
+      packed = type == PT_NACL_PACKED;
+    }
+  }
+out:
+  return packed;
+}
+
+/*
+ * Everything a launch needs to know about NEXE, from one open of it: its
+ * metadata record, read into RECORD (NACL_RECORD_SIZE bytes) with the
+ * number of settings it has for the loader in *NEXPORTS (or -1 if there's
+ * none), as the interp would find it, and whether it's packed.  Only the
+ * interp can unpack a packed nexe; the loader would be handed the ELF
+ * shell, so that's ENOEXEC.  A file that can't be read is left for the
+ * loader to complain about.
+ */
+static int read_nexe(const struct nacl_spawn_config *config,
+                     const char *nexe, char *record, const char **exports,
+                     int *nexports) {
+  struct stat st;
+  size_t size;
+  int fd = open(nexe, O_RDONLY | O_CLOEXEC);
+  int packed;
+
+  *nexports = -1;
+  if (fd < 0)
+    return 0;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return 0;
+  }
+  packed = is_packed(fd);
+  close(fd);
+  if (packed)
+    return ENOEXEC;
+  if (config->xattr != NULL || config->ldcache != NULL)
+    *nexports = read_metadata(config->xattr, config->ldcache, nexe, &st,
+                              record, &size, exports);
+  return 0;
+}
+
+/*
+ * Build the command for one launch in BUF, of command_size slots, and
+ * start it.  An empty ARGV is treated as just the nexe's name.
+ */
+static int spawn_command(pid_t *pid, const struct nacl_spawn_config *config,
+                         const char **buf, const char *nexe,
+                         const posix_spawn_file_actions_t *file_actions,
+                         const posix_spawnattr_t *attrp,
+                         char *const argv[], int argc, char *const envp[]) {
+  static char *const no_args[] = { NULL, NULL };
+  char record[NACL_RECORD_SIZE];
+  const char *exports[NACL_MAX_EXPORTS];
+  const char **new_envp = NULL;
+  const char *path;
+  int nexports, error;
+
+  if (argc == 0) {
+    argv = no_args;
+    argc = 1;
+  }
+  if (envp == NULL)
+    envp = environ;
+  error = read_nexe(config, nexe, record, exports, &nexports);
+  if (error != 0)
+    return error;
+  if (nexports > 0) {
+    int envc = count_args(envp);
+    new_envp = malloc((envc + nexports + 1) * sizeof(new_envp[0]));
+    if (new_envp == NULL)
+      return ENOMEM;
+    build_loader_envp(new_envp, (const char *const *) envp, exports,
+                      nexports);
+    envp = (char *const *) new_envp;
+  }
+
+  if (config->supervisor != NULL) {
+    const char *prefix[3];
+    path = prefix[0] = config->supervisor;
+    prefix[1] = config->loader;
+    prefix[2] = config->platform;
+    build_command_argv(buf, prefix, 3, nexe, argc,
+                       (const char *const *) argv);
+  } else if (config->command != NULL && nexports <= 0) {
+    path = config->command[0];
+    build_command_argv(buf, (const char *const *) config->command,
+                       config->ncommand, nexe, argc,
+                       (const char *const *) argv);
+  } else {
+    path = config->loader;
+    build_loader_argv(buf, config->loader, config->platform, nexe,
+                      argc, (const char *const *) argv);
+  }
+
+  error = posix_spawn(pid, path, file_actions, attrp, (char *const *) buf,
+                      envp);
+  free(new_envp);
+  return error;
+}
+
+int nacl_spawn(pid_t *pid, const struct nacl_spawn_config *config,
+               const char *nexe,
+               const posix_spawn_file_actions_t *file_actions,
+               const posix_spawnattr_t *attrp,
+               char *const argv[], char *const envp[]) {
+  int argc = count_args(argv);
+  const char **buf = malloc(command_size(config, argc) * sizeof(buf[0]));
+  int error;
+
+  if (buf == NULL)
+    return ENOMEM;
+  error = spawn_command(pid, config, buf, nexe, file_actions, attrp,
+                        argv, argc, envp);
+  free(buf);
+  return error;
+}
+
+size_t nacl_spawn_batch(const struct nacl_spawn_config *config,
+                        struct nacl_spawn_job *jobs, size_t njobs) {
+  const char **buf = NULL;
+  size_t size = 0, started = 0, i;
+
+  for (i = 0; i < njobs; ++i) {
+    struct nacl_spawn_job *job = &jobs[i];
+    int argc = count_args(job->argv);
+    size_t needed = command_size(config, argc);
+
+    job->pid = 0;
+    if (needed > size) {
+      free(buf);
+      buf = malloc(needed * sizeof(buf[0]));
+      size = buf == NULL ? 0 : needed;
+    }
+    if (buf == NULL) {
+      job->error = ENOMEM;
+      continue;
+    }
+
+    job->error = spawn_command(&job->pid, config, buf, job->nexe,
+                               job->file_actions, NULL,
+                               job->argv, argc, job->envp);
+    if (job->error == 0)
+      ++started;
+  }
+
+  free(buf);
+  return started;
+}
+
+/*
+ * Return the descriptor ARG refers to, if it's a NACL_INTERP_ARGFILE
+ * reference, or -1.  The interp sealed the memfd and named it, and both
+ * are checked, so an ordinary argument that happens to look like a
+ * reference is never mistaken for one.
+ */
+static int argfile_fd(const char *arg) {
+  static const char name[] = "/memfd:" NACL_ARGV_MEMFD_NAME " ";
+  const int seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE;
+  char path[64], target[sizeof(name) - 1];
+  const char *p = arg + sizeof(NACL_ARGV_REF_PREFIX) - 1;
+  char *end;
+  long fd;
+  int got;
+
+  if (strncmp(arg, NACL_ARGV_REF_PREFIX, sizeof(NACL_ARGV_REF_PREFIX) - 1))
+    return -1;
+  fd = strtol(p, &end, 10);
+  if (end == p || *end != '\0' || fd < 0 || fd > INT_MAX)
+    return -1;
+  got = fcntl(fd, F_GET_SEALS);
+  if (got < 0 || (got & seals) != seals)
+    return -1;
+  snprintf(path, sizeof(path), "/proc/self/fd/%ld", fd);
+  if (readlink(path, target, sizeof(target)) != sizeof(target) ||
+      memcmp(target, name, sizeof(target)) != 0)
+    return -1;
+  return fd;
+}
+
+int nacl_expand_argv(int *argc, char ***argv) {
+  struct stat st;
+  const char *image, *p, *end;
+  char **new_argv;
+  size_t count = 0, i;
+  int fd;
+
+  if (*argc < 1 || (fd = argfile_fd((*argv)[*argc - 1])) < 0)
+    return 0;
+
+  if (fstat(fd, &st) < 0)
+    return errno;
+  if (st.st_size == 0)
+    return EINVAL;
+  image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (image == MAP_FAILED)
+    return errno;
+  end = image + st.st_size;
+  if (end[-1] != '\0') {
+    munmap((void *) image, st.st_size);
+    return EINVAL;
+  }
+  for (p = image; p < end; ++p)
+    count += *p == '\0';
+
+  new_argv = malloc((*argc + count) * sizeof(new_argv[0]));
+  if (new_argv == NULL) {
+    munmap((void *) image, st.st_size);
+    return ENOMEM;
+  }
+  for (i = 0; i < (size_t) *argc - 1; ++i)
+    new_argv[i] = (*argv)[i];
+  for (p = image; p < end; p += strlen(p) + 1)
+    new_argv[i++] = (char *) p;
+  new_argv[i] = NULL;
+
+  close(fd);
+  *argc = i;
+  *argv = new_argv;
+  return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2011 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Launching nexes from a program, without execing the nexe and going
+ * through ld-nacl-*.so.1.  The command line is put together by the same
+ * code the interp uses (nacl_interp_start.h), and so is the per-nexe
+ * metadata record (nacl_nexe_meta.h): with NACL_INTERP_XATTR or
+ * NACL_INTERP_LDCACHE set when the configuration is made, an up-to-date
+ * record's settings, such as NACL_INTERP_LIBRARY_PATH, are put in the
+ * loader's environment just as the interp puts them.  So a nexe started
+ * this way sees what it would have seen if it had been run directly.
+ *
+ * A configuration either runs the loader for each launch, just as the
+ * interp does, or (with NACL_SPAWN_DIRECT) asks the loader once for the
+ * sel_ldr command it would run ("LOADER --print-command PLATFORM") and
+ * then runs sel_ldr itself.  That command is the loader's default, so a
+ * launch whose record has settings for the loader runs the loader even
+ * then.
+ *
+ * When NACL_INTERP_SUPERVISOR is set, each launch runs the supervisor
+ * with the loader, just as the interp does, so the mirror, the launch
+ * counts for nacl-hotd, the cgroup and the startup memo all apply; the
+ * command is then never resolved, even with NACL_SPAWN_DIRECT.
+ *
+ * Each launch opens the nexe once, for its stat and its ELF headers.
+ * What the interp still does that this doesn't:
+ *  - NACL_INTERP_PREFETCH and NACL_INTERP_TRACE are ignored.
+ *  - The arguments are always passed as they are, never through a
+ *    NACL_INTERP_ARGFILE.
+ *  - A nexe packed by nacl-pack can't be unpacked here; launching one
+ *    fails with ENOEXEC rather than handing the loader its ELF shell.
+ *
+ * The receiving end of NACL_INTERP_ARGFILE is here too, for whatever
+ * finally runs the nexe.  The interp only passes a reference to a loader
+ * marked as leading to it (see NACL_ARGV_XATTR_NAME), since neither the
+ * SDK loader script nor stock sel_ldr expands one.  nacl_vcache_standin
+ * does, so a loader script that runs it as sel_ldr can be marked.
+ *
+ * Functions returning int return 0 or an errno value, as posix_spawn does.
+ */
+
+#ifndef NACL_SPAWN_H
+#define NACL_SPAWN_H
+
+#include <spawn.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define NACL_SPAWN_DIRECT 1
+
+struct nacl_spawn_config {
+  char *loader;
+  char *platform;
+  char *supervisor;             /* $NACL_INTERP_SUPERVISOR, or NULL.  */
+  char *xattr;                  /* Likewise, NACL_INTERP_XATTR.  */
+  char *ldcache;                /* Likewise, NACL_INTERP_LDCACHE.  */
+  char **command;               /* The sel_ldr command, if direct.  */
+  size_t ncommand;
+};
+
+/*
+ * LOADER defaults to $NACL_INTERP_LOADER, and PLATFORM to the one the
+ * interp would assume for this build.  Setuid and similar programs are
+ * refused with EPERM, as the interp refuses them.
+ */
+int nacl_spawn_config_init(struct nacl_spawn_config *config,
+                           const char *loader, const char *platform,
+                           int flags);
+void nacl_spawn_config_destroy(struct nacl_spawn_config *config);
+
+/*
+ * Like posix_spawn for NEXE, with ARGV as the nexe's argument vector.
+ * ENVP may be NULL for the current environment.
+ */
+int nacl_spawn(pid_t *pid, const struct nacl_spawn_config *config,
+               const char *nexe,
+               const posix_spawn_file_actions_t *file_actions,
+               const posix_spawnattr_t *attrp,
+               char *const argv[], char *const envp[]);
+
+struct nacl_spawn_job {
+  const char *nexe;
+  char *const *argv;
+  char *const *envp;
+  const posix_spawn_file_actions_t *file_actions;
+  pid_t pid;                    /* Set by nacl_spawn_batch.  */
+  int error;                    /* Likewise; 0 if the job was started.  */
+};
+
+/*
+ * Start each of JOBS in turn, sharing one command buffer between them.
+ * Returns the number started; see each job's ERROR for the others.
+ */
+size_t nacl_spawn_batch(const struct nacl_spawn_config *config,
+                        struct nacl_spawn_job *jobs, size_t njobs);
+
+/*
+ * If the last of the *ARGC arguments in *ARGV is a reference to a sealed
+ * NACL_INTERP_ARGFILE memfd (see nacl_interp.c), replace it with the
+ * arguments it holds: *ARGV is set to a new vector, whose strings are
+ * mapped straight from the memfd, and *ARGC is updated.  The memfd is
+ * closed, and the vector lives as long as the program does.  Anything
+ * else is left alone.
+ */
+int nacl_expand_argv(int *argc, char ***argv);
+
+#endif  /* NACL_SPAWN_H */
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2011 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * The validation cache protocol's plumbing and client side; see
+ * nacl_vcache.h.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "nacl_vcache.h"
+
+int nacl_vcache_send(int conn, const char *line, int fd) {
+  union {
+    struct cmsghdr header;
+    char space[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct msghdr msg;
+  struct iovec iov;
+  ssize_t n;
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = (void *) line;
+  iov.iov_len = strlen(line);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (fd >= 0) {
+    struct cmsghdr *cmsg;
+    memset(&control, 0, sizeof(control));
+    msg.msg_control = control.space;
+    msg.msg_controllen = sizeof(control.space);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+
+  /*
+   * Lines are short enough that a stream socket takes them whole.
+   */
+  do
+    n = sendmsg(conn, &msg, MSG_NOSIGNAL);
+  while (n < 0 && errno == EINTR);
+  if (n != (ssize_t) iov.iov_len) {
+    if (n >= 0)
+      errno = EIO;
+    return -1;
+  }
+  return 0;
+}
+
+int nacl_vcache_receive(int conn, char buf[NACL_VCACHE_LINE_MAX], int *fd) {
+  size_t len = 0;
+
+  if (fd != NULL)
+    *fd = -1;
+
+  /*
+   * A byte at a time, so as never to read past the line; an attached
+   * descriptor arrives with the first byte.
+   */
+  while (len < NACL_VCACHE_LINE_MAX - 1) {
+    union {
+      struct cmsghdr header;
+      char space[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    ssize_t n;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &buf[len];
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.space;
+    msg.msg_controllen = sizeof(control.space);
+    n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg))
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        int received;
+        memcpy(&received, CMSG_DATA(cmsg), sizeof(int));
+        if (fd != NULL && *fd < 0)
+          *fd = received;
+        else
+          close(received);
+      }
+
+    if (buf[len] == '\n') {
+      buf[len] = '\0';
+      return len;
+    }
+    ++len;
+  }
+
+  if (fd != NULL && *fd >= 0) {
+    close(*fd);
+    *fd = -1;
+  }
+  return -1;
+}
+
+int nacl_vcache_connect(const char *socket_path) {
+  struct sockaddr_un addr;
+  int conn;
+
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socket_path);
+
+  conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (conn < 0)
+    return -1;
+  if (connect(conn, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+    close(conn);
+    return -1;
+  }
+  return conn;
+}
+
+int nacl_vcache_lookup(int conn, int file_fd, const char *validator,
+                       char key[NACL_SHA256_HEX_SIZE]) {
+  char line[NACL_VCACHE_LINE_MAX];
+  const char *rest;
+  int hit;
+
+  if (strchr(validator, '\n') != NULL ||
+      snprintf(line, sizeof(line), "LOOKUP %s\n", validator) >=
+      (int) sizeof(line)) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (nacl_vcache_send(conn, line, file_fd) < 0 ||
+      nacl_vcache_receive(conn, line, NULL) < 0)
+    return -1;
+
+  if (!strncmp(line, "HIT ", 4)) {
+    hit = 1;
+    rest = line + 4;
+  } else if (!strncmp(line, "MISS ", 5)) {
+    hit = 0;
+    rest = line + 5;
+  } else {
+    return -1;
+  }
+
+  if (strlen(rest) != NACL_SHA256_HEX_SIZE - 1)
+    return -1;
+  memcpy(key, rest, NACL_SHA256_HEX_SIZE);
+  return hit;
+}
+
+int nacl_vcache_add(int conn, const char *key) {
+  char line[NACL_VCACHE_LINE_MAX];
+
+  snprintf(line, sizeof(line), "ADD %s\n", key);
+  if (nacl_vcache_send(conn, line, -1) < 0 ||
+      nacl_vcache_receive(conn, line, NULL) < 0)
+    return -1;
+  return strcmp(line, "OK") == 0 ? 0 : -1;
+}
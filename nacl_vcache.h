@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2011 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * The validation cache protocol, spoken between nacl-vcached and sel_ldr
+ * (or nacl_vcache_standin, which plays sel_ldr's part for testing).
+ *
+ * A client connects to the daemon's unix stream socket, named by
+ * NACL_VALIDATION_CACHE_SOCKET in its environment, and makes requests of
+ * one line each:
+ *
+ *      LOOKUP VALIDATOR        with an open descriptor for the file
+ *                              attached (SCM_RIGHTS)
+ *      -> HIT KEY | MISS KEY | ERROR MESSAGE
+ *
+ *      ADD KEY                 after validating a file that missed
+ *      -> OK | ERROR MESSAGE
+ *
+ * VALIDATOR identifies the validator and everything its verdict depends
+ * on (version, CPU features, options), so a cached verdict from another
+ * validator never counts.  KEY is the SHA-256 of VALIDATOR, a newline, and
+ * the hex SHA-256 of the file's contents.  The daemon finds the content
+ * hash without reading the file when the file's device, inode, size,
+ * mtime and ctime are what they were when it last hashed it.  Since any
+ * write changes the ctime, a file can't change under a cached hash.  A
+ * client may only ADD a key the daemon gave it in a MISS on the same
+ * connection.
+ *
+ * Clients treat any failure to talk to the daemon as a miss, and simply
+ * validate.
+ *
+ * sel_ldr as shipped in the SDK is not such a client: it never reads
+ * NACL_VALIDATION_CACHE_SOCKET, and validates every file every time.
+ * The cache only saves anything with a sel_ldr patched to make these
+ * requests, which the loader script runs when NACL_INTERP_VCACHE_SEL_LDR
+ * names it.
+ */
+
+#ifndef NACL_VCACHE_H
+#define NACL_VCACHE_H
+
+#include "nacl_sha256.h"
+
+#define NACL_VCACHE_SOCKET_ENV "NACL_VALIDATION_CACHE_SOCKET"
+#define NACL_VCACHE_LINE_MAX 1024
+
+/*
+ * Send LINE (which must end in a newline), with FD attached unless it's
+ * -1.  Returns 0, or -1 with errno set.
+ */
+int nacl_vcache_send(int conn, const char *line, int fd);
+
+/*
+ * Read one line, without its newline, into BUF.  If FD isn't NULL, a
+ * descriptor that came with it is stored there (or -1 if none did).
+ * Returns the line's length, or -1 on error or end of file.
+ */
+int nacl_vcache_receive(int conn, char buf[NACL_VCACHE_LINE_MAX], int *fd);
+
+/*
+ * Client calls.  nacl_vcache_connect returns the connection or -1.
+ * nacl_vcache_lookup returns 1 for a hit, 0 for a miss, and -1 for an
+ * error; on a hit or a miss KEY is filled in.  nacl_vcache_add returns 0
+ * or -1.
+ */
+int nacl_vcache_connect(const char *socket_path);
+int nacl_vcache_lookup(int conn, int file_fd, const char *validator,
+                       char key[NACL_SHA256_HEX_SIZE]);
+int nacl_vcache_add(int conn, const char *key);
+
+#endif  /* NACL_VCACHE_H */
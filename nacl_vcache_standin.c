@@ -0,0 +1,328 @@
+/*
+ * Copyright (c) 2011 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * A stand-in for sel_ldr's side of the validation cache protocol (see
+ * nacl_vcache.h), and a benchmark of what the cache saves.
+ *
+ * Usage: nacl_vcache_standin [-v] [-a] [-S] [-B IRT] -- RTLD
+ *                            [--library-path DIR] [NEXE ARGS...]
+ *        nacl_vcache_standin -b [-n COUNT] [-d DAEMON] NEXE
+ *
+ * The first form takes sel_ldr's arguments, so a loader script can run it
+ * in sel_ldr's place.  A NACL_INTERP_ARGFILE reference at the end of
+ * them is expanded first (see nacl_expand_argv in nacl_spawn.h).  It "validates" the IRT, RTLD and NEXE as sel_ldr
+ * would, asking the daemon at $NACL_VALIDATION_CACHE_SOCKET first and
+ * telling it about each file that passes, and then exits 0.  A file
+ * fails validation if it isn't ELF, which makes it exit 126 without
+ * caching anything.  The validation itself only reads every byte, at
+ * about the speed of the real validator.  With -v it reports on stderr
+ * whether each file was a cache hit, or was validated.
+ *
+ * The second form times COUNT (default 20) launches of the first form
+ * for NEXE, first with no cache and then with a fresh store served by
+ * DAEMON (default nacl-vcached, from the PATH).  The first cached launch
+ * misses and fills the cache; the rest should all hit.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nacl_spawn.h"
+#include "nacl_vcache.h"
+
+#define VALIDATOR_NAME "nacl_vcache_standin-1"
+
+extern char **environ;
+
+static int verbose;
+
+/*
+ * Keeps the stand-in validation from being optimized away.
+ */
+static volatile unsigned int sink;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Decode every byte, the way the validator walks every instruction.
+ */
+static int validate(int fd) {
+  const unsigned char *image;
+  unsigned int state = 0;
+  struct stat st;
+  off_t i;
+
+  if (fstat(fd, &st) < 0 || st.st_size < 4)
+    return -1;
+  image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (image == MAP_FAILED)
+    return -1;
+  if (memcmp(image, "\177ELF", 4) != 0) {
+    munmap((void *) image, st.st_size);
+    return -1;
+  }
+  for (i = 0; i < st.st_size; ++i)
+    state = (state * 33) ^ image[i];
+  sink = state;
+  munmap((void *) image, st.st_size);
+  return 0;
+}
+
+/*
+ * Validate FILE unless the cache says it already passed.  CONN is the
+ * daemon connection, or -1.
+ */
+static int check_file(int conn, const char *validator, const char *file) {
+  char key[NACL_SHA256_HEX_SIZE];
+  int fd, hit = -1;
+
+  fd = open(file, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    perror(file);
+    return -1;
+  }
+
+  if (conn >= 0)
+    hit = nacl_vcache_lookup(conn, fd, validator, key);
+  if (hit == 1) {
+    if (verbose)
+      fprintf(stderr, "%s: hit\n", file);
+    close(fd);
+    return 0;
+  }
+
+  if (validate(fd) < 0) {
+    fprintf(stderr, "%s: validation failed\n", file);
+    close(fd);
+    return -1;
+  }
+  if (verbose)
+    fprintf(stderr, "%s: validated\n", file);
+  if (hit == 0)
+    nacl_vcache_add(conn, key);
+  close(fd);
+  return 0;
+}
+
+static int stand_in_sel_ldr(int argc, char **argv) {
+  const char *irt = NULL;
+  const char *socket_path;
+  char validator[256];
+  struct utsname un;
+  int conn = -1;
+  int i, result = 0;
+  int opt;
+
+  if ((errno = nacl_expand_argv(&argc, &argv)) != 0) {
+    perror("nacl_vcache_standin: expanding arguments");
+    return 127;
+  }
+  while ((opt = getopt(argc, argv, "vaSB:")) != -1) {
+    switch (opt) {
+      case 'v':
+        verbose = 1;
+        break;
+      case 'a':
+      case 'S':
+        break;
+      case 'B':
+        irt = optarg;
+        break;
+      default:
+        return 127;
+    }
+  }
+  if (optind >= argc)
+    return 127;
+
+  /*
+   * The verdict depends on the validator and on which CPU it was for.
+   */
+  uname(&un);
+  snprintf(validator, sizeof(validator), "%s %s", VALIDATOR_NAME,
+           un.machine);
+
+  socket_path = getenv(NACL_VCACHE_SOCKET_ENV);
+  if (socket_path != NULL && socket_path[0] != '\0')
+    conn = nacl_vcache_connect(socket_path);
+
+  if (irt != NULL && check_file(conn, validator, irt) < 0)
+    result = 126;
+  if (result == 0 && check_file(conn, validator, argv[optind]) < 0)
+    result = 126;
+  i = optind + 1;
+  if (i + 1 < argc && !strcmp(argv[i], "--library-path"))
+    i += 2;
+  if (result == 0 && i < argc && check_file(conn, validator, argv[i]) < 0)
+    result = 126;
+
+  if (conn >= 0)
+    close(conn);
+  return result;
+}
+
+static int compare_double(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+static double percentile(const double *sorted, size_t n, double pct) {
+  size_t i = (size_t) (pct / 100 * (n - 1) + 0.5);
+  return sorted[i];
+}
+
+static double launch(char **argv) {
+  double start = now();
+  int status;
+  pid_t pid = fork();
+
+  if (pid < 0) {
+    perror("fork");
+    exit(1);
+  }
+  if (pid == 0) {
+    execv("/proc/self/exe", argv);
+    _exit(127);
+  }
+  if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "launch failed with status %#x\n", status);
+    exit(1);
+  }
+  return now() - start;
+}
+
+static void summarize(const char *label, double *times, size_t n) {
+  qsort(times, n, sizeof(times[0]), compare_double);
+  printf("%-14s %6zu %10.3f %10.3f %10.3f\n", label, n,
+         percentile(times, n, 50) * 1e3, percentile(times, n, 90) * 1e3,
+         times[n - 1] * 1e3);
+}
+
+static int remove_entry(const char *path, const struct stat *st,
+                        int type, struct FTW *ftw) {
+  return remove(path);
+}
+
+/*
+ * Start DAEMON in the foreground on STORE, and wait for its socket.
+ */
+static pid_t start_daemon(const char *daemon, const char *store,
+                          const char *socket_path) {
+  struct stat st;
+  pid_t pid = fork();
+  int i;
+
+  if (pid < 0) {
+    perror("fork");
+    exit(1);
+  }
+  if (pid == 0) {
+    execlp(daemon, daemon, "-f", "-t", "0", store, (char *) NULL);
+    perror(daemon);
+    _exit(127);
+  }
+  for (i = 0; i < 5000; ++i) {
+    int status;
+    if (stat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode))
+      return pid;
+    if (waitpid(pid, &status, WNOHANG) == pid)
+      break;
+    usleep(1000);
+  }
+  fprintf(stderr, "%s did not start\n", daemon);
+  exit(1);
+}
+
+static int bench(const char *nexe, unsigned long count, const char *daemon) {
+  char store[] = "/tmp/nacl_vcache.XXXXXX";
+  char socket_path[sizeof(store) + sizeof("/socket")];
+  char *argv[] = { "nacl_vcache_standin", "--", (char *) nexe, NULL };
+  double *times;
+  double first;
+  unsigned long i;
+  pid_t pid;
+
+  times = calloc(count, sizeof(times[0]));
+  if (times == NULL || mkdtemp(store) == NULL) {
+    perror("bench");
+    return 1;
+  }
+  snprintf(socket_path, sizeof(socket_path), "%s/socket", store);
+
+  unsetenv(NACL_VCACHE_SOCKET_ENV);
+  for (i = 0; i < count; ++i)
+    times[i] = launch(argv);
+  printf("%-14s %6s %10s %10s %10s\n", "", "runs", "p50 ms", "p90 ms",
+         "max ms");
+  summarize("uncached", times, count);
+
+  pid = start_daemon(daemon, store, socket_path);
+  setenv(NACL_VCACHE_SOCKET_ENV, socket_path, 1);
+  first = launch(argv);
+  for (i = 0; i < count; ++i)
+    times[i] = launch(argv);
+  summarize("first (miss)", &first, 1);
+  summarize("cached", times, count);
+
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+  nftw(store, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+  free(times);
+  return 0;
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr, "\
+Usage: %s [-v] [-a] [-S] [-B IRT] -- RTLD [--library-path DIR] [NEXE...]\n\
+       %s -b [-n COUNT] [-d DAEMON] NEXE\n", argv0, argv0);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  const char *daemon = "nacl-vcached";
+  unsigned long count = 20;
+  int opt;
+
+  if (argc < 2 || strcmp(argv[1], "-b") != 0)
+    return stand_in_sel_ldr(argc, argv);
+
+  optind = 2;
+  while ((opt = getopt(argc, argv, "n:d:")) != -1) {
+    switch (opt) {
+      case 'n':
+        count = strtoul(optarg, NULL, 0);
+        break;
+      case 'd':
+        daemon = optarg;
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  if (argc - optind != 1 || count == 0)
+    usage(argv[0]);
+  return bench(argv[optind], count, daemon);
+}
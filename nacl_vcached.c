@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2011 The Native Client Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * nacl-vcached: the local validation cache service (see nacl_vcache.h).
+ *
+ * Usage: nacl-vcached [-f] [-t IDLE-SECONDS] DIR
+ *
+ * DIR holds the store and the socket, DIR/socket.  Only one daemon runs
+ * per DIR; starting another while one is running does nothing, so the
+ * loader starts it for every launch (it only does, with
+ * NACL_INTERP_VCACHE, when NACL_INTERP_VCACHE_SEL_LDR names a sel_ldr
+ * that uses the cache).  A socket left behind by a daemon that died is
+ * replaced.  Unless -f is given, the daemon detaches once its socket is
+ * ready for connections.  It exits after IDLE-SECONDS
+ * (default 600) without a connection; 0 means never.
+ *
+ * The store is plain files:
+ *      DIR/ids/DEV-INO         "STAMP HASH": the content hash of that
+ *                              file as of the stamp
+ *      DIR/ok/KEY              a validator passed the contents for KEY
+ * so it survives restarts and can be cleared with rm.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "nacl_sha256.h"
+#include "nacl_vcache.h"
+
+/*
+ * How many MISS keys a connection may have outstanding for ADD.
+ */
+#define MAX_PENDING 64
+
+static const char *store;
+static pthread_mutex_t active_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int active;
+
+static void die(const char *what) {
+  fprintf(stderr, "nacl-vcached: %s: %s\n", what, strerror(errno));
+  exit(1);
+}
+
+static void format_stamp(char *buf, size_t size, const struct stat *st) {
+  snprintf(buf, size, "%llx:%llx:%llx.%lx:%llx.%lx:%llx",
+           (unsigned long long) st->st_dev, (unsigned long long) st->st_ino,
+           (unsigned long long) st->st_mtim.tv_sec, st->st_mtim.tv_nsec,
+           (unsigned long long) st->st_ctim.tv_sec, st->st_ctim.tv_nsec,
+           (unsigned long long) st->st_size);
+}
+
+/*
+ * Hash the contents of FD without disturbing its file offset, which the
+ * client shares.
+ */
+static int hash_contents(int fd, char hex[NACL_SHA256_HEX_SIZE]) {
+  struct nacl_sha256 ctx;
+  static __thread char buf[1 << 16];
+  off_t offset = 0;
+  ssize_t n;
+
+  nacl_sha256_init(&ctx);
+  while ((n = pread(fd, buf, sizeof(buf), offset)) != 0) {
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    nacl_sha256_update(&ctx, buf, n);
+    offset += n;
+  }
+  nacl_sha256_hex(&ctx, hex);
+  return 0;
+}
+
+/*
+ * Find the content hash of FD, from DIR/ids if the stamp still matches.
+ */
+static int content_hash(int fd, char hex[NACL_SHA256_HEX_SIZE]) {
+  char path[4096], tmp[4096 + 32], stamp[128], record[256];
+  struct stat before, after;
+  ssize_t n;
+  int idfd;
+
+  if (fstat(fd, &before) < 0)
+    return -1;
+  if (!S_ISREG(before.st_mode)) {
+    errno = EINVAL;
+    return -1;
+  }
+  format_stamp(stamp, sizeof(stamp), &before);
+  snprintf(path, sizeof(path), "%s/ids/%llx-%llx", store,
+           (unsigned long long) before.st_dev,
+           (unsigned long long) before.st_ino);
+
+  idfd = open(path, O_RDONLY | O_CLOEXEC);
+  if (idfd >= 0) {
+    size_t len = strlen(stamp);
+    n = read(idfd, record, sizeof(record) - 1);
+    close(idfd);
+    if (n == (ssize_t) (len + 1 + NACL_SHA256_HEX_SIZE - 1) &&
+        !memcmp(record, stamp, len) && record[len] == ' ') {
+      memcpy(hex, record + len + 1, NACL_SHA256_HEX_SIZE - 1);
+      hex[NACL_SHA256_HEX_SIZE - 1] = '\0';
+      return 0;
+    }
+  }
+
+  if (hash_contents(fd, hex) < 0 || fstat(fd, &after) < 0)
+    return -1;
+  if (after.st_ctim.tv_sec != before.st_ctim.tv_sec ||
+      after.st_ctim.tv_nsec != before.st_ctim.tv_nsec) {
+    errno = EAGAIN;             /* It changed while we were reading it.  */
+    return -1;
+  }
+
+  snprintf(tmp, sizeof(tmp), "%s.%lx", path, (unsigned long) pthread_self());
+  idfd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (idfd >= 0) {
+    n = snprintf(record, sizeof(record), "%s %s", stamp, hex);
+    if (write(idfd, record, n) == n && close(idfd) == 0)
+      rename(tmp, path);
+    else
+      unlink(tmp);
+  }
+  return 0;
+}
+
+static void make_key(const char *validator, const char *hash,
+                     char key[NACL_SHA256_HEX_SIZE]) {
+  struct nacl_sha256 ctx;
+  nacl_sha256_init(&ctx);
+  nacl_sha256_update(&ctx, validator, strlen(validator));
+  nacl_sha256_update(&ctx, "\n", 1);
+  nacl_sha256_update(&ctx, hash, strlen(hash));
+  nacl_sha256_hex(&ctx, key);
+}
+
+static void ok_path(char *path, size_t size, const char *key) {
+  snprintf(path, size, "%s/ok/%s", store, key);
+}
+
+static void *serve(void *arg) {
+  char pending[MAX_PENDING][NACL_SHA256_HEX_SIZE];
+  char line[NACL_VCACHE_LINE_MAX];
+  char reply[NACL_VCACHE_LINE_MAX];
+  size_t npending = 0;
+  int conn = (int) (intptr_t) arg;
+  int fd;
+
+  while (nacl_vcache_receive(conn, line, &fd) >= 0) {
+    char hash[NACL_SHA256_HEX_SIZE], key[NACL_SHA256_HEX_SIZE];
+    char path[4096];
+
+    if (!strncmp(line, "LOOKUP ", 7)) {
+      if (fd < 0) {
+        snprintf(reply, sizeof(reply), "ERROR no file\n");
+      } else if (content_hash(fd, hash) < 0) {
+        snprintf(reply, sizeof(reply), "ERROR %s\n", strerror(errno));
+      } else {
+        make_key(line + 7, hash, key);
+        ok_path(path, sizeof(path), key);
+        if (access(path, F_OK) == 0) {
+          snprintf(reply, sizeof(reply), "HIT %s\n", key);
+        } else {
+          memcpy(pending[npending++ % MAX_PENDING], key, sizeof(key));
+          snprintf(reply, sizeof(reply), "MISS %s\n", key);
+        }
+      }
+    } else if (!strncmp(line, "ADD ", 4)) {
+      size_t i;
+      for (i = 0; i < npending && i < MAX_PENDING; ++i)
+        if (!strcmp(pending[i], line + 4))
+          break;
+      if (i == npending || i == MAX_PENDING) {
+        snprintf(reply, sizeof(reply), "ERROR not looked up\n");
+      } else {
+        int okfd;
+        ok_path(path, sizeof(path), pending[i]);
+        okfd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (okfd >= 0) {
+          close(okfd);
+          snprintf(reply, sizeof(reply), "OK\n");
+        } else {
+          snprintf(reply, sizeof(reply), "ERROR %s\n", strerror(errno));
+        }
+      }
+    } else {
+      snprintf(reply, sizeof(reply), "ERROR unknown request\n");
+    }
+
+    if (fd >= 0)
+      close(fd);
+    if (nacl_vcache_send(conn, reply, -1) < 0)
+      break;
+  }
+
+  close(conn);
+  pthread_mutex_lock(&active_lock);
+  --active;
+  pthread_mutex_unlock(&active_lock);
+  return NULL;
+}
+
+static void make_dir(const char *dir, const char *sub) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/%s", dir, sub);
+  if (mkdir(path, 0755) < 0 && errno != EEXIST)
+    die(path);
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s [-f] [-t IDLE-SECONDS] DIR\n", argv0);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  struct sockaddr_un addr;
+  char path[4096];
+  unsigned long idle = 600;
+  int foreground = 0;
+  int lockfd, listener, ready[2] = { -1, -1 };
+  int opt;
+
+  while ((opt = getopt(argc, argv, "ft:")) != -1) {
+    switch (opt) {
+      case 'f':
+        foreground = 1;
+        break;
+      case 't':
+        idle = strtoul(optarg, NULL, 0);
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  if (argc - optind != 1)
+    usage(argv[0]);
+  store = argv[optind];
+
+  if (mkdir(store, 0755) < 0 && errno != EEXIST)
+    die(store);
+  make_dir(store, "ids");
+  make_dir(store, "ok");
+
+  snprintf(path, sizeof(path), "%s/lock", store);
+  lockfd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (lockfd < 0)
+    die(path);
+  if (flock(lockfd, LOCK_EX | LOCK_NB) < 0) {
+    if (errno == EWOULDBLOCK)
+      return 0;                 /* Somebody else is serving.  */
+    die(path);
+  }
+
+  /*
+   * Detach, but don't let our parent go on until the socket is ready.
+   */
+  if (!foreground) {
+    pid_t pid;
+    char c;
+    if (pipe(ready) < 0)
+      die("pipe");
+    pid = fork();
+    if (pid < 0)
+      die("fork");
+    if (pid > 0) {
+      close(ready[1]);
+      return read(ready[0], &c, 1) == 1 ? 0 : 1;
+    }
+    close(ready[0]);
+    setsid();
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/socket", store) >=
+      (int) sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    die(store);
+  }
+  unlink(addr.sun_path);
+  listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listener < 0)
+    die("socket");
+  if (bind(listener, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+      listen(listener, 128) < 0)
+    die(addr.sun_path);
+
+  signal(SIGPIPE, SIG_IGN);
+  if (!foreground) {
+    int null = open("/dev/null", O_RDWR);
+    if (write(ready[1], "", 1) != 1)
+      die("ready");
+    close(ready[1]);
+    if (null >= 0) {
+      dup2(null, STDIN_FILENO);
+      dup2(null, STDOUT_FILENO);
+      close(null);
+    }
+  }
+
+  for (;;) {
+    struct pollfd pfd = { listener, POLLIN, 0 };
+    pthread_t thread;
+    int conn, n;
+
+    n = poll(&pfd, 1, idle == 0 ? -1 : (int) (idle * 1000));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n == 0) {
+      unsigned int busy;
+      pthread_mutex_lock(&active_lock);
+      busy = active;
+      pthread_mutex_unlock(&active_lock);
+      if (busy == 0)
+        break;
+      continue;
+    }
+
+    conn = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+    if (conn < 0)
+      continue;
+    pthread_mutex_lock(&active_lock);
+    ++active;
+    pthread_mutex_unlock(&active_lock);
+    if (pthread_create(&thread, NULL, serve, (void *) (intptr_t) conn) != 0) {
+      close(conn);
+      pthread_mutex_lock(&active_lock);
+      --active;
+      pthread_mutex_unlock(&active_lock);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+
+  /*
+   * Unlink the socket while still holding the lock, so a new daemon
+   * can't have made its own there in the meantime.
+   */
+  unlink(addr.sun_path);
+  return 0;
+}